@@ -10,8 +10,46 @@
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
+// * The log keeps a block it has yet to write home in the cache
+//     with bpin, until bunpin.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * breadahead starts reading blocks without waiting; each
+//     buffer is released when its read completes.
+// * bread_async and bwrite_async start I/O and return at once,
+//     so that many requests can be queued on the disk; call
+//     bwait on each buffer before using or releasing it. If
+//     b->iodone is set, the disk interrupt calls it instead.
+// * bread_range and bwrite_range do the same for a range of
+//     consecutive blocks, which the disk moves with one command
+//     for several blocks at a time.
+//
+// The cache starts with NBUF buffers and grows into free memory,
+// in chunks of BCHUNK buffers, rather than evict a cached block,
+// up to BCACHEPCT percent of RAM, or a buffer for every block of
+// the file system if that is less. A buf holds only a pointer to
+// its data: a chunk's headers fill one page and its data BCHUNK
+// * BSIZE / PGSIZE more. Under memory pressure bshrink() hands
+// a chunk back, moving the blocks it caches to free buffers
+// elsewhere.
+//
+// Buffers are found through a hash table on (dev, blockno), each
+// bucket with its own lock, so that lookups of different blocks
+// do not contend. binit() sizes the table for the largest the
+// cache can grow to, so that chains stay short as it grows.
+// bcache.lock only guards the LRU list and recycling a buffer for
+// another block: lock order is bcache.lock, then bucket locks; a
+// bucket lock alone is never held while taking another lock.
+//
+// Replacement is 2Q, so that one pass over a big file does not
+// flush the blocks everything else uses. A block read into the
+// cache goes on the cold list, in FIFO order; hits there do not
+// move it. Blocks evicted from the cold list are remembered in a
+// ring of NGHOST ghosts, hashed on (dev, blockno), and one read
+// again while remembered goes on the hot list, in LRU order. The
+// cold list is evicted from first while it holds more than a
+// quarter of the buffers. Build with -DBLRU for plain LRU, with
+// every block on the hot list.
 //
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
@@ -21,79 +59,462 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
+
+#define NBUCKET 13  // fewest hash buckets
+#define BCHUNK  32
+#define NGHOST  256
+#define NGHASH  127  // ghost hash chains
+
+// The lists a buffer can be on (b->list).
+#define BFREE 0  // unused, and in no bucket
+#define BCOLD 1  // read once, in FIFO order
+#define BHOT  2  // read again, in LRU order
+
+// Buffers added as the cache grows, with their data pages.
+// Fits in a page.
+struct bchunk {
+	struct bchunk *next;
+	struct buf buf[BCHUNK];
+	uchar *page[BCHUNK * BSIZE / PGSIZE];
+};
+
+struct bucket {
+	struct spinlock lock;  // guards the chain, and dev, blockno, refcnt of its bufs
+	struct buf *head;      // chain through hnext
+};
 
 struct {
 	struct spinlock lock;
 	struct buf buf[NBUF];
+	uchar data[NBUF][BSIZE];
+	struct bchunk *chunk;  // the buffers beyond buf[]
+	uint nbuf;             // buffers in all
+	uint maxbuf;           // most buffers to grow to
+
+	// Lists of buffers through prev/next, indexed by b->list.
+	// list[l].next is the most recently added, or used.
+	struct buf list[3];
+	uint nlist[3];
+
+	// Blocks recently evicted from the cold list, in a ring,
+	// and hashed on (dev, blockno) to find them.
+	struct ghost {
+		uint dev;
+		uint blockno;
+		struct ghost *hnext;  // chain of ghosthash[]
+	} ghost[NGHOST];
+	struct ghost *ghosthash[NGHASH];
+	uint ghosthand;
+
+	uint hits;       // lookups of a cached block
+	uint misses;     // and of one that had to be read
+	uint evictions;  // cached blocks recycled
 
-	// Linked list of all buffers, through prev/next.
-	// head.next is most recently used.
-	struct buf head;
+	struct bucket *bucket;  // nbucket of them, a prime
+	uint nbucket;
 } bcache;
 
+static struct bucket*
+bucket(uint dev, uint blockno) {
+	return &bcache.bucket[(dev * 31 + blockno) % bcache.nbucket];
+}
+
+// Put b at the head of list l. Caller holds bcache.lock.
+static void bpush(int l, struct buf *b) {
+	b->list = l;
+	b->next = bcache.list[l].next;
+	b->prev = &bcache.list[l];
+	bcache.list[l].next->prev = b;
+	bcache.list[l].next = b;
+	bcache.nlist[l]++;
+}
+
+// Take b off its list. Caller holds bcache.lock.
+static void bunlink(struct buf *b) {
+	b->next->prev = b->prev;
+	b->prev->next = b->next;
+	bcache.nlist[b->list]--;
+}
+
 // Initial total buffer cache
 void binit(void) {
 	struct buf *b;
+	struct bucket *h;
+	uint n, d;
+	int order;
 
+	if (sizeof(struct bchunk) > PGSIZE)
+		panic("binit: bchunk");
 	initlock(&bcache.lock, "bcache");
+	bcache.nbuf = NBUF;
+	bcache.maxbuf = phystop / 100 * BCACHEPCT / BSIZE;
+	// no more buffers than the file system has blocks
+	if (bcache.maxbuf > FSSIZE)
+		bcache.maxbuf = FSSIZE;
+
+	// about two buffers per bucket when the cache is full:
+	// the first prime past maxbuf/2
+	n = bcache.maxbuf / 2 > NBUCKET ? bcache.maxbuf / 2 | 1 : NBUCKET;
+	for (;; n += 2) {
+		for (d = 3; d * d <= n && n % d != 0; d += 2)
+			;
+		if (d * d > n)
+			break;
+	}
+	for (order = 0; (PGSIZE << order) < n * sizeof(struct bucket); order++)
+		;
+	if ((bcache.bucket = (struct bucket*) kalloc_order(order)) == 0)
+		panic("binit: buckets");
+	bcache.nbucket = n;
+	for (h = bcache.bucket; h < &bcache.bucket[bcache.nbucket]; h++) {
+		initlock(&h->lock, "bcache.bucket");
+		h->head = 0;
+	}
 
 //PAGEBREAK!
-	// Create linked list of buffers
-	bcache.head.prev = &bcache.head;
-	bcache.head.next = &bcache.head;
+	// Create linked lists of buffers, all free to begin with
+	for (b = bcache.list; b < &bcache.list[NELEM(bcache.list)]; b++) {
+		b->prev = b;
+		b->next = b;
+	}
 	for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
-		b->next = bcache.head.next;
-		b->prev = &bcache.head;
 		initsleeplock(&b->lock, "buffer");
-		bcache.head.next->prev = b;
-		bcache.head.next = b;
+		b->data = bcache.data[b - bcache.buf];
+		bpush(BFREE, b);
 	}
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
-// get buffer from device by block number
-static struct buf*
-bget(uint dev, uint blockno) {
+// Add a chunk of buffers to the free list. Caller holds
+// bcache.lock. Returns 0, or -1 if out of memory.
+static int bgrow(void) {
+	struct bchunk *c;
 	struct buf *b;
+	int i;
 
-	acquire(&bcache.lock);
+	if ((c = (struct bchunk*) kalloc()) == 0)
+		return -1;
+	memset(c, 0, sizeof(*c));
+	for (i = 0; i < NELEM(c->page); i++) {
+		if ((c->page[i] = (uchar*) kalloc()) == 0) {
+			while (--i >= 0)
+				kfree((char*) c->page[i]);
+			kfree((char*) c);
+			return -1;
+		}
+	}
+	for (b = c->buf; b < &c->buf[BCHUNK]; b++) {
+		initsleeplock(&b->lock, "buffer");
+		b->data = c->page[(b - c->buf) * BSIZE / PGSIZE]
+				+ (b - c->buf) * BSIZE % PGSIZE;
+		bpush(BFREE, b);
+	}
+	c->next = bcache.chunk;
+	bcache.chunk = c;
+	bcache.nbuf += BCHUNK;
+	return 0;
+}
 
-	// Is the block already cached?
-	// looking for block in buffer list one by one until get
-	for (b = bcache.head.next; b != &bcache.head; b = b->next) {
+// Take b out of its bucket h, if it is in one. Caller holds h->lock.
+static void unhash(struct bucket *h, struct buf *b) {
+	struct buf **pp;
+
+	for (pp = &h->head; *pp; pp = &(*pp)->hnext)
+		if (*pp == b) {
+			*pp = b->hnext;
+			return;
+		}
+}
+
+// Find block blockno of dev in bucket h, and take a reference
+// to it if ref is set. Caller holds h->lock.
+static struct buf*
+bfind(struct bucket *h, uint dev, uint blockno, int ref) {
+	struct buf *b;
+
+	for (b = h->head; b; b = b->hnext) {
 		if (b->dev == dev && b->blockno == blockno) {
-			b->refcnt++;
-			release(&bcache.lock);
-			// waiting for the block release by brelse();
-			acquiresleep(&b->lock);
+			if (ref)
+				b->refcnt++;
 			return b;
 		}
 	}
+	return 0;
+}
+
+#ifndef BLRU
+static struct ghost**
+ghostchain(uint dev, uint blockno) {
+	return &bcache.ghosthash[(dev * 31 + blockno) % NGHASH];
+}
+
+// Take g off its hash chain, if it is on one, and clear it:
+// block 0 of device 0, the boot sector, is never cached.
+// Caller holds bcache.lock.
+static void ghostclear(struct ghost *g) {
+	struct ghost **pp;
+
+	for (pp = ghostchain(g->dev, g->blockno); *pp; pp = &(*pp)->hnext)
+		if (*pp == g) {
+			*pp = g->hnext;
+			break;
+		}
+	g->dev = 0;
+	g->blockno = 0;
+}
+
+// Remember that block blockno of dev was evicted from the
+// cold list, in place of the oldest ghost. Caller holds
+// bcache.lock.
+static void ghostadd(uint dev, uint blockno) {
+	struct ghost *g, **pp;
+
+	g = &bcache.ghost[bcache.ghosthand++ % NGHOST];
+	ghostclear(g);
+	g->dev = dev;
+	g->blockno = blockno;
+	pp = ghostchain(dev, blockno);
+	g->hnext = *pp;
+	*pp = g;
+}
+
+// Is block blockno of dev remembered? If so, forget it.
+// Caller holds bcache.lock.
+static int ghostfind(uint dev, uint blockno) {
+	struct ghost *g;
+
+	for (g = *ghostchain(dev, blockno); g; g = g->hnext) {
+		if (g->dev == dev && g->blockno == blockno) {
+			ghostclear(g);
+			return 1;
+		}
+	}
+	return 0;
+}
+#endif
+
+// Is b one of the buffers of chunk c?
+static int inchunk(struct bchunk *c, struct buf *b) {
+	return b >= c->buf && b < &c->buf[BCHUNK];
+}
+
+// Take buffer b of chunk c, which is to be freed, out of the
+// cache. The block it holds moves to a free buffer outside c, in
+// b's place on its list, or is evicted if there is none. b is
+// left on no list, but marked BFREE, so that a bput() about to
+// move it on the hot list does not. Returns -1, leaving b as it
+// is, if b is in use. Caller holds bcache.lock.
+static int bmove(struct bchunk *c, struct buf *b) {
+	struct bucket *h;
+	struct buf *nb;
+
+	if (b->list == BFREE) {
+		bunlink(b);
+		return 0;
+	}
+	h = bucket(b->dev, b->blockno);
+	acquire(&h->lock);
+	if (b->refcnt != 0 || (b->flags & B_DIRTY)) {
+		release(&h->lock);
+		return -1;
+	}
+	unhash(h, b);
+	for (nb = bcache.list[BFREE].prev; nb != &bcache.list[BFREE]; nb = nb->prev)
+		if (!inchunk(c, nb))
+			break;
+	if (nb == &bcache.list[BFREE]) {
+#ifndef BLRU
+		if (b->list == BCOLD)
+			ghostadd(b->dev, b->blockno);
+#endif
+		bunlink(b);
+		b->list = BFREE;
+		bcache.evictions++;
+		release(&h->lock);
+		return 0;
+	}
+	bunlink(nb);
+	memmove(nb->data, b->data, BSIZE);
+	nb->dev = b->dev;
+	nb->blockno = b->blockno;
+	nb->flags = b->flags;
+	nb->refcnt = 0;
+	nb->pins = 0;
+	nb->list = b->list;
+	nb->prev = b->prev;
+	nb->next = b->next;
+	b->prev->next = nb;
+	b->next->prev = nb;
+	b->list = BFREE;
+	nb->hnext = h->head;
+	h->head = nb;
+	release(&h->lock);
+	return 0;
+}
+
+// Give the memory of a chunk of buffers back to kalloc(), when it
+// runs out. Its buffers are taken out of the cache one at a time,
+// each under its own bucket lock, so lookups go on meanwhile; a
+// chunk with a buffer in use is passed over. Returns 0, or -1 if
+// every chunk has one in use, or there is none.
+int bshrink(void) {
+	struct bchunk *c, **pc;
+	struct buf *b;
+	int i;
 
-	// Not cached;
-	// recycle an unused buffer.
-	// Even if refcnt==0, B_DIRTY indicates a buffer is in use
-	// because log.c has modified it but not yet committed it.
+	acquire(&bcache.lock);
+	for (pc = &bcache.chunk; (c = *pc) != 0; pc = &c->next) {
+		for (b = c->buf; b < &c->buf[BCHUNK]; b++)
+			if (bmove(c, b) < 0)
+				break;
+		if (b == &c->buf[BCHUNK])
+			break;
+		// b is in use: the ones before it are in no bucket or
+		// list now, and stay in the cache as free buffers
+		while (--b >= c->buf)
+			bpush(BFREE, b);
+	}
+	if (c) {
+		*pc = c->next;
+		bcache.nbuf -= BCHUNK;
+	}
+	release(&bcache.lock);
+	if (c == 0)
+		return -1;
+	for (i = 0; i < NELEM(c->page); i++)
+		kfree((char*) c->page[i]);
+	kfree((char*) c);
+	return 0;
+}
+
+// Find an unused buffer on list l, oldest first, to recycle for
+// a block of bucket h, and take it out of the bucket it is in.
+// Caller holds bcache.lock and h->lock.
+static struct buf*
+bevict(int l, struct bucket *h) {
+	struct bucket *vh;
+	struct buf *b;
+
+	// log.c pins the blocks it has modified but not yet written
+	// home (see bpin), so with refcnt==0 and no write pending a
+	// buffer is unused.
 	// attention: buffer list is a cycle linked list, head.prev is the tail
-	for (b = bcache.head.prev; b != &bcache.head; b = b->prev) {
+	for (b = bcache.list[l].prev; b != &bcache.list[l]; b = b->prev) {
+		vh = bucket(b->dev, b->blockno);
+		if (vh != h)
+			acquire(&vh->lock);
 		if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-			b->dev = dev;
-			b->blockno = blockno;
-			b->flags = 0;
-			b->refcnt = 1;
-			release(&bcache.lock);
-			// waiting for the block release by brelse();
-			acquiresleep(&b->lock);
+			unhash(vh, b);
+			if (vh != h)
+				release(&vh->lock);
 			return b;
 		}
+		if (vh != h)
+			release(&vh->lock);
+	}
+	return 0;
+}
+
+// Choose a buffer to recycle for a block of bucket h.
+// Caller holds bcache.lock and h->lock.
+static struct buf*
+bvictim(struct bucket *h) {
+	struct buf *b;
+
+	if ((b = bevict(BFREE, h)) != 0)
+		return b;
+	// rather than evict a cached block, grow
+	if (bcache.nbuf < bcache.maxbuf && bgrow() == 0)
+		return bevict(BFREE, h);
+#ifdef BLRU
+	b = bevict(BHOT, h);
+#else
+	if (bcache.nlist[BCOLD] > bcache.nbuf / 4) {
+		if ((b = bevict(BCOLD, h)) == 0)
+			b = bevict(BHOT, h);
+	} else if ((b = bevict(BHOT, h)) == 0)
+		b = bevict(BCOLD, h);
+	if (b && b->list == BCOLD)
+		ghostadd(b->dev, b->blockno);
+#endif
+	// all pinned or dirty: grow past maxbuf if memory allows
+	if (b == 0 && bgrow() == 0)
+		b = bevict(BFREE, h);
+	return b;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+// If ahead is set, return 0 instead of waiting for a cached one,
+// or when there is no buffer to spare: readahead is best-effort.
+// get buffer from device by block number
+static struct buf*
+bget(uint dev, uint blockno, int ahead) {
+	struct bucket *h;
+	struct buf *b;
+
+	h = bucket(dev, blockno);
+
+	// Is the block already cached?
+	acquire(&h->lock);
+	b = bfind(h, dev, blockno, !ahead);
+	release(&h->lock);
+	if (b && ahead)
+		return 0;
+	if (b) {
+		__sync_fetch_and_add(&bcache.hits, 1);
+		// waiting for the block release by brelse();
+		acquiresleep(&b->lock);
+		return b;
+	}
+
+	// Not cached; look again holding bcache.lock, under which
+	// all blocks enter the cache, then recycle an unused buffer.
+	acquire(&bcache.lock);
+	acquire(&h->lock);
+	if ((b = bfind(h, dev, blockno, !ahead)) != 0) {
+		release(&h->lock);
+		release(&bcache.lock);
+		if (ahead)
+			return 0;
+		__sync_fetch_and_add(&bcache.hits, 1);
+		acquiresleep(&b->lock);
+		return b;
+	}
+	if ((b = bvictim(h)) == 0) {
+		release(&h->lock);
+		release(&bcache.lock);
+		if (ahead)
+			return 0;
+		panic("bget: no buffers");
 	}
-	panic("bget: no buffers");
+	if (b->list != BFREE)
+		bcache.evictions++;
+	bunlink(b);
+#ifdef BLRU
+	bpush(BHOT, b);
+#else
+	bpush(ghostfind(dev, blockno) ? BHOT : BCOLD, b);
+#endif
+	if (!ahead)
+		bcache.misses++;
+	b->dev = dev;
+	b->blockno = blockno;
+	b->flags = 0;
+	b->refcnt = 1;
+	b->hnext = h->head;
+	h->head = b;
+	release(&h->lock);
+	release(&bcache.lock);
+	// waiting for the block release by brelse();
+	acquiresleep(&b->lock);
+	return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,7 +523,7 @@ bread(uint dev, uint blockno) {
 	struct buf *b;
 
 	// get buffer from buffer
-	b = bget(dev, blockno);  // first get buffer from buffer list
+	b = bget(dev, blockno, 0);  // first get buffer from buffer list
 	// if the buffer is not valid -> need to synchronize buffer from disk again
 	if ((b->flags & B_VALID) == 0) {
 		// synchronize buffer and disk
@@ -111,6 +532,70 @@ bread(uint dev, uint blockno) {
 	return b;
 }
 
+// Start reading blocks [blockno, blockno+n) into the cache,
+// those that are not there already, without waiting for them
+// (see bdone). Runs of them are read with one request.
+void breadahead(uint dev, uint blockno, uint n) {
+	struct buf *run[RAMAX], *b;
+	int nrun;
+
+	nrun = 0;
+	for (; n > 0; n--, blockno++) {
+		if ((b = bget(dev, blockno, 1)) != 0) {
+			b->flags |= B_ASYNC;
+			b->iodone = bdone;
+			run[nrun++] = b;
+		}
+		// a cached block ends the run
+		if (nrun > 0 && (b == 0 || nrun == RAMAX || n == 1)) {
+			iderwn(run, nrun);
+			nrun = 0;
+		}
+	}
+}
+
+// Return locked bufs bs[0..n) with the contents of blocks
+// [blockno, blockno+n), reading those not cached in runs.
+void bread_range(uint dev, uint blockno, int n, struct buf **bs) {
+	int i, j;
+
+	for (i = 0; i < n; i++)
+		bs[i] = bget(dev, blockno + i, 0);
+	for (i = 0; i < n; i = j + 1) {
+		for (j = i; j < n && (bs[j]->flags & B_VALID) == 0; j++)
+			bs[j]->flags |= B_ASYNC;
+		if (j > i)
+			iderwn(&bs[i], j - i);
+	}
+	for (i = 0; i < n; i++)
+		bwait(bs[i]);
+}
+
+// Return a locked buf for the indicated block without reading
+// it, for a caller that overwrites all of its data.
+struct buf*
+bget_blank(uint dev, uint blockno) {
+	struct buf *b;
+
+	b = bget(dev, blockno, 0);
+	b->flags |= B_VALID;
+	return b;
+}
+
+// Return a locked buf for the indicated block, starting to read
+// it if it is not cached. Call bwait before using its data.
+struct buf*
+bread_async(uint dev, uint blockno) {
+	struct buf *b;
+
+	b = bget(dev, blockno, 0);
+	if ((b->flags & B_VALID) == 0) {
+		b->flags |= B_ASYNC;
+		iderw(b);
+	}
+	return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void bwrite(struct buf *b) {
 	if (!holdingsleep(&b->lock))
@@ -120,28 +605,123 @@ void bwrite(struct buf *b) {
 	iderw(b);
 }
 
+// Start writing b's contents to disk.  Must be locked, and stays
+// locked: call bwait before changing or releasing it.
+void bwrite_async(struct buf *b) {
+	if (!holdingsleep(&b->lock))
+		panic("bwrite_async");
+	b->flags |= B_DIRTY | B_ASYNC;
+	iderw(b);
+}
+
+// Start writing locked bufs bs[0..n), of consecutive blocks, to
+// disk, like bwrite_async: call bwait on each before changing or
+// releasing it.
+void bwrite_range(struct buf **bs, int n) {
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (!holdingsleep(&bs[i]->lock))
+			panic("bwrite_range");
+		bs[i]->flags |= B_DIRTY | B_ASYNC;
+	}
+	iderwn(bs, n);
+}
+
+// Wait for I/O started by bread_async or bwrite_async on b.
+// Waiting for each buffer of a batch in turn is a barrier:
+// the disk has then done all of them.
+void bwait(struct buf *b) {
+	if (!holdingsleep(&b->lock))
+		panic("bwait");
+	iderwait(b);
+}
+
+// Drop a reference to b, which is no longer locked.
+static void bput(struct buf *b) {
+	struct bucket *h;
+	uint refcnt;
+
+	// b cannot be recycled, so stays in h, until refcnt is 0
+	h = bucket(b->dev, b->blockno);
+	acquire(&h->lock);
+	refcnt = --b->refcnt;
+	release(&h->lock);
+
+	if (refcnt == 0 && b->list == BHOT) {
+		// no one is waiting for it. (It may be recycled before
+		// it gets to the head; that only costs LRU order.)
+		acquire(&bcache.lock);
+		if (b->list == BHOT) {
+			bunlink(b);
+			bpush(BHOT, b);
+		}
+		release(&bcache.lock);
+	}
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Move to the head of the hot list, if it is on it.
 void brelse(struct buf *b) {
 	if (!holdingsleep(&b->lock))
 		panic("brelse");
 
 	releasesleep(&b->lock);
+	bput(b);
+}
 
-	acquire(&bcache.lock);
-	b->refcnt--;
-	if (b->refcnt == 0) {
-		// no one is waiting for it.
-		b->next->prev = b->prev;
-		b->prev->next = b->next;
-		b->next = bcache.head.next;
-		b->prev = &bcache.head;
-		bcache.head.next->prev = b;
-		bcache.head.next = b;
-	}
+// Keep b in the cache, even once released, until bunpin(b).
+// Pins nest.
+void bpin(struct buf *b) {
+	struct bucket *h;
+
+	h = bucket(b->dev, b->blockno);
+	acquire(&h->lock);
+	b->refcnt++;
+	b->pins++;
+	release(&h->lock);
+}
 
+void bunpin(struct buf *b) {
+	struct bucket *h;
+
+	h = bucket(b->dev, b->blockno);
+	acquire(&h->lock);
+	b->pins--;
+	release(&h->lock);
+	bput(b);
+}
+
+// Release buffer b, whose asynchronous read has completed, for
+// the process that started it. Called from the disk interrupt.
+void bdone(struct buf *b) {
+	releasesleep(&b->lock);
+	bput(b);
+}
+// Fill in the buffer cache counters of st.
+void biostat(struct iostat *st) {
+	struct buf *b;
+	int l;
+
+	acquire(&bcache.lock);
+	st->nbuf = bcache.nbuf;
+	st->hits = bcache.hits;
+	st->misses = bcache.misses;
+	st->evictions = bcache.evictions;
+	st->dirty = 0;
+	for (l = BCOLD; l <= BHOT; l++)
+		for (b = bcache.list[l].next; b != &bcache.list[l]; b = b->next)
+			if (b->pins > 0)
+				st->dirty++;
 	release(&bcache.lock);
 }
+
+// Print buffer cache statistics to the console. For debugging.
+// No lock, like procdump().
+void bcachedump(void) {
+	cprintf("bcache: %d bufs, %d hot, %d cold, %d hits, %d misses\n",
+			bcache.nbuf, bcache.nlist[BHOT], bcache.nlist[BCOLD],
+			bcache.hits, bcache.misses);
+}
 //PAGEBREAK!
 // Blank page.
-
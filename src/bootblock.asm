@@ -0,0 +1,392 @@
+
+bootblock.o:     file format elf32-i386
+
+
+Disassembly of section .text:
+
+00007c00 <start>:
+# with %cs=0 %ip=7c00.
+# setup all segments, swithc to protected mode, and setup stack is there
+.code16                       # Assemble for 16-bit mode
+.globl start
+start:
+  cli                         # BIOS enabled interrupts; disable
+    7c00:	fa                   	cli
+
+  # Zero data segment registers DS, ES, and SS.
+  xorw    %ax,%ax             # Set %ax to zero
+    7c01:	31 c0                	xor    %eax,%eax
+  movw    %ax,%ds             # -> Data Segment
+    7c03:	8e d8                	mov    %eax,%ds
+  movw    %ax,%es             # -> Extra Segment
+    7c05:	8e c0                	mov    %eax,%es
+  movw    %ax,%ss             # -> Stack Segment
+    7c07:	8e d0                	mov    %eax,%ss
+
+00007c09 <seta20.1>:
+
+  # Physical address line A20 is tied to zero so that the first PCs 
+  # with 2 MB would run software that assumed 1 MB.  Undo that.
+seta20.1:
+  inb     $0x64,%al               # Wait for not busy
+    7c09:	e4 64                	in     $0x64,%al
+  testb   $0x2,%al
+    7c0b:	a8 02                	test   $0x2,%al
+  jnz     seta20.1
+    7c0d:	75 fa                	jne    7c09 <seta20.1>
+
+  movb    $0xd1,%al               # 0xd1 -> port 0x64
+    7c0f:	b0 d1                	mov    $0xd1,%al
+  outb    %al,$0x64
+    7c11:	e6 64                	out    %al,$0x64
+
+00007c13 <seta20.2>:
+
+seta20.2:
+  inb     $0x64,%al               # Wait for not busy
+    7c13:	e4 64                	in     $0x64,%al
+  testb   $0x2,%al
+    7c15:	a8 02                	test   $0x2,%al
+  jnz     seta20.2
+    7c17:	75 fa                	jne    7c13 <seta20.2>
+
+  movb    $0xdf,%al               # 0xdf -> port 0x60
+    7c19:	b0 df                	mov    $0xdf,%al
+  outb    %al,$0x60
+    7c1b:	e6 60                	out    %al,$0x60
+
+  # Ask the BIOS for the physical memory map, one 20-byte E820
+  # entry at a time, into E820MAP+4 on; then store the end of the
+  # entries at E820MAP for the kernel (see physinit in kalloc.c).
+  xorl    %ebx,%ebx               # Continuation value: first entry
+    7c1d:	66 31 db             	xor    %bx,%bx
+  movw    $(E820MAP+4),%di        # ES:DI -> next entry
+    7c20:	bf                   	.byte 0xbf
+    7c21:	04 80                	add    $0x80,%al
+
+00007c23 <e820>:
+e820:
+  movl    $0xe820,%eax
+    7c23:	66 b8 20 e8          	mov    $0xe820,%ax
+    7c27:	00 00                	add    %al,(%eax)
+  movl    $20,%ecx                # Entry size
+    7c29:	66 b9 14 00          	mov    $0x14,%cx
+    7c2d:	00 00                	add    %al,(%eax)
+  movl    $0x534d4150,%edx        # 'SMAP'
+    7c2f:	66 ba 50 41          	mov    $0x4150,%dx
+    7c33:	4d                   	dec    %ebp
+    7c34:	53                   	push   %ebx
+  int     $0x15
+    7c35:	cd 15                	int    $0x15
+  jc      e820done                # No E820, or past the last entry
+    7c37:	72 08                	jb     7c41 <e820done>
+  addw    $20,%di
+    7c39:	83 c7 14             	add    $0x14,%edi
+  testl   %ebx,%ebx               # Zero after the last entry
+    7c3c:	66 85 db             	test   %bx,%bx
+  jnz     e820
+    7c3f:	75 e2                	jne    7c23 <e820>
+
+00007c41 <e820done>:
+e820done:
+  movw    %di,E820MAP
+    7c41:	89 3e                	mov    %edi,(%esi)
+    7c43:	00 80 0f 01 16 a0    	add    %al,-0x5fe9fef1(%eax)
+
+  # Switch from real to protected mode.  Use a bootstrap GDT that makes
+  # virtual addresses map directly to physical addresses so that the
+  # effective memory map doesn't change during the transition.
+  lgdt    gdtdesc
+    7c49:	7c 0f                	jl     7c5a <start32+0x1>
+  movl    %cr0, %eax
+    7c4b:	20 c0                	and    %al,%al
+  orl     $CR0_PE, %eax # close cr0_pe
+    7c4d:	66 83 c8 01          	or     $0x1,%ax
+  movl    %eax, %cr0
+    7c51:	0f 22 c0             	mov    %eax,%cr0
+//PAGEBREAK!
+  # Complete the transition to 32-bit protected mode by using a long jmp
+  # to reload %cs and %eip.  The segment descriptors are set up with no
+  # translation, so that the mapping is still the identity mapping.
+  # long jump by 0x8 index of GDT for code segment, the low 3 bits is GDT, and 0 privelege level
+  ljmp    $(SEG_KCODE<<3), $start32
+    7c54:	ea                   	.byte 0xea
+    7c55:	59                   	pop    %ecx
+    7c56:	7c 08                	jl     7c60 <start32+0x7>
+	...
+
+00007c59 <start32>:
+
+.code32  # Tell assembler to generate 32-bit code now.
+start32:
+  # Set up the protected-mode data segment registers
+  movw    $(SEG_KDATA<<3), %ax    # Our data segment selector
+    7c59:	66 b8 10 00          	mov    $0x10,%ax
+  movw    %ax, %ds                # index 0x10 of GDT -> DS: Data Segment
+    7c5d:	8e d8                	mov    %eax,%ds
+  movw    %ax, %es                # index 0x10 of GDT -> ES: Extra Segment
+    7c5f:	8e c0                	mov    %eax,%es
+  movw    %ax, %ss                # index 0x10 of GDT -> SS: Stack Segment
+    7c61:	8e d0                	mov    %eax,%ss
+  movw    $0, %ax                 # Zero segments not ready for use
+    7c63:	66 b8 00 00          	mov    $0x0,%ax
+  movw    %ax, %fs                # 0x0 -> FS
+    7c67:	8e e0                	mov    %eax,%fs
+  movw    %ax, %gs                # 0x0 -> GS
+    7c69:	8e e8                	mov    %eax,%gs
+
+  # Set up the stack pointer and call into C.
+  movl    $start, %esp # move 0x7c00 to esp for stack, now we setup all require of C function, GDT, stack ...
+    7c6b:	bc 00 7c 00 00       	mov    $0x7c00,%esp
+  call    bootmain # now, we can call first C function
+    7c70:	e8 f0 00 00 00       	call   7d65 <bootmain>
+
+  # If bootmain returns (it shouldn't), trigger a Bochs
+  # breakpoint if running under Bochs, then loop.
+  movw    $0x8a00, %ax            # 0x8a00 -> port 0x8a00
+    7c75:	66 b8 00 8a          	mov    $0x8a00,%ax
+  movw    %ax, %dx
+    7c79:	66 89 c2             	mov    %ax,%dx
+  outw    %ax, %dx
+    7c7c:	66 ef                	out    %ax,(%dx)
+  movw    $0x8ae0, %ax            # 0x8ae0 -> port 0x8a00
+    7c7e:	66 b8 e0 8a          	mov    $0x8ae0,%ax
+  outw    %ax, %dx
+    7c82:	66 ef                	out    %ax,(%dx)
+
+00007c84 <spin>:
+spin:
+  jmp     spin
+    7c84:	eb fe                	jmp    7c84 <spin>
+    7c86:	66 90                	xchg   %ax,%ax
+
+00007c88 <gdt>:
+	...
+    7c90:	ff                   	(bad)
+    7c91:	ff 00                	incl   (%eax)
+    7c93:	00 00                	add    %al,(%eax)
+    7c95:	9a cf 00 ff ff 00 00 	lcall  $0x0,$0xffff00cf
+    7c9c:	00                   	.byte 0x0
+    7c9d:	92                   	xchg   %eax,%edx
+    7c9e:	cf                   	iret
+	...
+
+00007ca0 <gdtdesc>:
+    7ca0:	17                   	pop    %ss
+    7ca1:	00                   	.byte 0x0
+    7ca2:	88 7c 00 00          	mov    %bh,0x0(%eax,%eax,1)
+
+00007ca6 <waitdisk>:
+// Routines to let C code use special x86 instructions.
+
+static inline uchar inb(ushort port) {
+	uchar data;
+
+	asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+    7ca6:	ba f7 01 00 00       	mov    $0x1f7,%edx
+    7cab:	ec                   	in     (%dx),%al
+	entry();
+}
+
+void waitdisk(void) {
+	// Wait for disk ready.
+	while ((inb(0x1F7) & 0xC0) != 0x40)
+    7cac:	83 e0 c0             	and    $0xffffffc0,%eax
+    7caf:	3c 40                	cmp    $0x40,%al
+    7cb1:	75 f8                	jne    7cab <waitdisk+0x5>
+		;
+}
+    7cb3:	c3                   	ret
+
+00007cb4 <readsect>:
+
+// load boot require code
+// Read a single sector at offset into dst.
+void readsect(void *dst, uint offset) {
+    7cb4:	55                   	push   %ebp
+    7cb5:	89 e5                	mov    %esp,%ebp
+    7cb7:	57                   	push   %edi
+    7cb8:	53                   	push   %ebx
+    7cb9:	8b 5d 0c             	mov    0xc(%ebp),%ebx
+	// Issue command.
+	// wait for disk is ready
+	waitdisk();
+    7cbc:	e8 e5 ff ff ff       	call   7ca6 <waitdisk>
+			"d" (port), "0" (addr), "1" (cnt) :
+			"memory", "cc");
+}
+
+static inline void outb(ushort port, uchar data) {
+	asm volatile("out %0,%1" : : "a" (data), "d" (port));
+    7cc1:	b8 01 00 00 00       	mov    $0x1,%eax
+    7cc6:	ba f2 01 00 00       	mov    $0x1f2,%edx
+    7ccb:	ee                   	out    %al,(%dx)
+    7ccc:	ba f3 01 00 00       	mov    $0x1f3,%edx
+    7cd1:	89 d8                	mov    %ebx,%eax
+    7cd3:	ee                   	out    %al,(%dx)
+	outb(0x1F2, 1);   // count = 1
+	outb(0x1F3, offset);
+	outb(0x1F4, offset >> 8);
+    7cd4:	89 d8                	mov    %ebx,%eax
+    7cd6:	c1 e8 08             	shr    $0x8,%eax
+    7cd9:	ba f4 01 00 00       	mov    $0x1f4,%edx
+    7cde:	ee                   	out    %al,(%dx)
+	outb(0x1F5, offset >> 16);
+    7cdf:	89 d8                	mov    %ebx,%eax
+    7ce1:	c1 e8 10             	shr    $0x10,%eax
+    7ce4:	ba f5 01 00 00       	mov    $0x1f5,%edx
+    7ce9:	ee                   	out    %al,(%dx)
+	outb(0x1F6, (offset >> 24) | 0xE0);
+    7cea:	89 d8                	mov    %ebx,%eax
+    7cec:	c1 e8 18             	shr    $0x18,%eax
+    7cef:	83 c8 e0             	or     $0xffffffe0,%eax
+    7cf2:	ba f6 01 00 00       	mov    $0x1f6,%edx
+    7cf7:	ee                   	out    %al,(%dx)
+    7cf8:	b8 20 00 00 00       	mov    $0x20,%eax
+    7cfd:	ba f7 01 00 00       	mov    $0x1f7,%edx
+    7d02:	ee                   	out    %al,(%dx)
+	outb(0x1F7, 0x20);  // cmd 0x20 - read sectors
+
+	// Read data.
+	waitdisk();
+    7d03:	e8 9e ff ff ff       	call   7ca6 <waitdisk>
+	asm volatile("cld; rep insl" :
+    7d08:	8b 7d 08             	mov    0x8(%ebp),%edi
+    7d0b:	b9 80 00 00 00       	mov    $0x80,%ecx
+    7d10:	ba f0 01 00 00       	mov    $0x1f0,%edx
+    7d15:	fc                   	cld
+    7d16:	f3 6d                	rep insl (%dx),%es:(%edi)
+	insl(0x1F0, dst, SECTSIZE / 4);
+}
+    7d18:	5b                   	pop    %ebx
+    7d19:	5f                   	pop    %edi
+    7d1a:	5d                   	pop    %ebp
+    7d1b:	c3                   	ret
+
+00007d1c <readseg>:
+
+// Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
+// Might copy more than asked.
+void readseg(uchar* pa, uint count, uint offset) {
+    7d1c:	55                   	push   %ebp
+    7d1d:	89 e5                	mov    %esp,%ebp
+    7d1f:	57                   	push   %edi
+    7d20:	56                   	push   %esi
+    7d21:	53                   	push   %ebx
+    7d22:	83 ec 0c             	sub    $0xc,%esp
+    7d25:	8b 5d 08             	mov    0x8(%ebp),%ebx
+    7d28:	8b 75 10             	mov    0x10(%ebp),%esi
+	uchar* epa;
+
+	epa = pa + count;
+    7d2b:	89 df                	mov    %ebx,%edi
+    7d2d:	03 7d 0c             	add    0xc(%ebp),%edi
+
+	// Round down to sector boundary.
+	pa -= offset % SECTSIZE;
+    7d30:	89 f0                	mov    %esi,%eax
+    7d32:	25 ff 01 00 00       	and    $0x1ff,%eax
+    7d37:	29 c3                	sub    %eax,%ebx
+
+	// Translate from bytes to sectors; kernel starts at sector 1.
+	offset = (offset / SECTSIZE) + 1;
+    7d39:	c1 ee 09             	shr    $0x9,%esi
+    7d3c:	83 c6 01             	add    $0x1,%esi
+
+	// If this is too slow, we could read lots of sectors at a time.
+	// We'd write more to memory than asked, but it doesn't matter --
+	// we load in increasing order.
+	for (; pa < epa; pa += SECTSIZE, offset++)
+    7d3f:	39 fb                	cmp    %edi,%ebx
+    7d41:	73 1a                	jae    7d5d <readseg+0x41>
+		readsect(pa, offset);
+    7d43:	83 ec 08             	sub    $0x8,%esp
+    7d46:	56                   	push   %esi
+    7d47:	53                   	push   %ebx
+    7d48:	e8 67 ff ff ff       	call   7cb4 <readsect>
+	for (; pa < epa; pa += SECTSIZE, offset++)
+    7d4d:	81 c3 00 02 00 00    	add    $0x200,%ebx
+    7d53:	83 c6 01             	add    $0x1,%esi
+    7d56:	83 c4 10             	add    $0x10,%esp
+    7d59:	39 fb                	cmp    %edi,%ebx
+    7d5b:	72 e6                	jb     7d43 <readseg+0x27>
+}
+    7d5d:	8d 65 f4             	lea    -0xc(%ebp),%esp
+    7d60:	5b                   	pop    %ebx
+    7d61:	5e                   	pop    %esi
+    7d62:	5f                   	pop    %edi
+    7d63:	5d                   	pop    %ebp
+    7d64:	c3                   	ret
+
+00007d65 <bootmain>:
+void bootmain(void) {
+    7d65:	55                   	push   %ebp
+    7d66:	89 e5                	mov    %esp,%ebp
+    7d68:	57                   	push   %edi
+    7d69:	56                   	push   %esi
+    7d6a:	53                   	push   %ebx
+    7d6b:	83 ec 10             	sub    $0x10,%esp
+	readseg((uchar*) elf, 4096, 0);
+    7d6e:	6a 00                	push   $0x0
+    7d70:	68 00 10 00 00       	push   $0x1000
+    7d75:	68 00 00 01 00       	push   $0x10000
+    7d7a:	e8 9d ff ff ff       	call   7d1c <readseg>
+	if (elf->magic != ELF_MAGIC)
+    7d7f:	83 c4 10             	add    $0x10,%esp
+    7d82:	81 3d 00 00 01 00 7f 	cmpl   $0x464c457f,0x10000
+    7d89:	45 4c 46 
+    7d8c:	75 21                	jne    7daf <bootmain+0x4a>
+	ph = (struct proghdr*) ((uchar*) elf + elf->phoff);
+    7d8e:	a1 1c 00 01 00       	mov    0x1001c,%eax
+    7d93:	8d 98 00 00 01 00    	lea    0x10000(%eax),%ebx
+	eph = ph + elf->phnum;
+    7d99:	0f b7 35 2c 00 01 00 	movzwl 0x1002c,%esi
+    7da0:	c1 e6 05             	shl    $0x5,%esi
+    7da3:	01 de                	add    %ebx,%esi
+	for (; ph < eph; ph++) {
+    7da5:	39 f3                	cmp    %esi,%ebx
+    7da7:	72 15                	jb     7dbe <bootmain+0x59>
+	entry();
+    7da9:	ff 15 18 00 01 00    	call   *0x10018
+}
+    7daf:	8d 65 f4             	lea    -0xc(%ebp),%esp
+    7db2:	5b                   	pop    %ebx
+    7db3:	5e                   	pop    %esi
+    7db4:	5f                   	pop    %edi
+    7db5:	5d                   	pop    %ebp
+    7db6:	c3                   	ret
+	for (; ph < eph; ph++) {
+    7db7:	83 c3 20             	add    $0x20,%ebx
+    7dba:	39 f3                	cmp    %esi,%ebx
+    7dbc:	73 eb                	jae    7da9 <bootmain+0x44>
+		pa = (uchar*) ph->paddr;
+    7dbe:	8b 7b 0c             	mov    0xc(%ebx),%edi
+		readseg(pa, ph->filesz, ph->off);
+    7dc1:	83 ec 04             	sub    $0x4,%esp
+    7dc4:	ff 73 04             	push   0x4(%ebx)
+    7dc7:	ff 73 10             	push   0x10(%ebx)
+    7dca:	57                   	push   %edi
+    7dcb:	e8 4c ff ff ff       	call   7d1c <readseg>
+		if (ph->memsz > ph->filesz)
+    7dd0:	8b 4b 14             	mov    0x14(%ebx),%ecx
+    7dd3:	8b 43 10             	mov    0x10(%ebx),%eax
+    7dd6:	83 c4 10             	add    $0x10,%esp
+    7dd9:	39 c8                	cmp    %ecx,%eax
+    7ddb:	73 da                	jae    7db7 <bootmain+0x52>
+			stosb(pa + ph->filesz, 0, ph->memsz - ph->filesz);
+    7ddd:	01 c7                	add    %eax,%edi
+    7ddf:	29 c1                	sub    %eax,%ecx
+			"d" (port), "0" (addr), "1" (cnt) :
+			"cc");
+}
+
+static inline void stosb(void *addr, int data, int cnt) {
+	asm volatile("cld; rep stosb" :
+    7de1:	b8 00 00 00 00       	mov    $0x0,%eax
+    7de6:	fc                   	cld
+    7de7:	f3 aa                	rep stos %al,%es:(%edi)
+			"=D" (addr), "=c" (cnt) :
+			"0" (addr), "1" (cnt), "a" (data) :
+			"memory", "cc");
+}
+    7de9:	eb cc                	jmp    7db7 <bootmain+0x52>
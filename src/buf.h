@@ -4,12 +4,18 @@ struct buf {
 	uint blockno;
 	struct sleeplock lock;
 	uint refcnt;
+	uint pins;         // log transactions holding it in the cache
+	int list;          // bcache list it is on
 	struct buf *prev; // LRU cache list
 	struct buf *next;
+	struct buf *hnext; // hash bucket chain
 	struct buf *qnext; // disk queue
-	uchar data[BSIZE];
+	struct buf *rnext; // rest of a multi-block disk request
+	uchar *data;       // BSIZE bytes
+	void (*iodone)(struct buf*); // if set, called when B_ASYNC I/O completes
 };
 #define B_BUSY 0x1  // buffer has been read from disk
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // iderw() does not wait for the I/O to complete
 
@@ -2,8 +2,11 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iostat;
 struct pipe;
 struct proc;
+struct rastate;
+struct vma;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
@@ -15,6 +18,19 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            breadahead(uint, uint, uint);
+struct buf*     bread_async(uint, uint);
+struct buf*     bget_blank(uint, uint);
+void            bwrite_async(struct buf*);
+void            bread_range(uint, uint, int, struct buf**);
+void            bwrite_range(struct buf**, int);
+void            bwait(struct buf*);
+void            bdone(struct buf*);
+void            bpin(struct buf*);
+void            bunpin(struct buf*);
+int             bshrink(void);
+void            bcachedump(void);
+void            biostat(struct iostat*);
 
 // console.c
 void            consoleinit(void);
@@ -33,9 +49,12 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filereadat(struct file*, char*, uint, int);
+int             filewriteat(struct file*, char*, uint, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
+int             blocktype(uint, uint);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -50,6 +69,8 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+void            ireadahead(struct inode*, uint, uint);
+void            readahead(struct inode*, struct rastate*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -57,6 +78,9 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderwn(struct buf**, int);
+void            iderwait(struct buf*);
+void            idestat(struct iostat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -65,9 +89,18 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kalloc_order(int);
+char*           kalloc_zeroed(void);
 void            kfree(char*);
+void            kfree_order(char*, int);
+void            kincref(char*);
 void            kinit1(void*, void*);
+void            physinit(void);
+extern uint     phystop;
 void            kinit2(void*, void*);
+void            kmemstat(int*);
+void*           kzerowanted(void);
+void            kzerod(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -84,6 +117,8 @@ void            microdelay(int);
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
+void            log_free(uint);
+int             log_pending(uint);
 void            begin_op();
 void            end_op();
 
@@ -114,9 +149,12 @@ void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+void            setpgdir(struct proc*, pde_t*);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(char*, void (*)(void));
+char*           swapvictim(uint);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
@@ -132,6 +170,14 @@ int             mywakeup(void*);
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// shm.c
+void            shminit(void);
+int             shmget(int, int);
+int             shmat(int);
+int             shmdt(uint);
+void            shmdup(struct vma*);
+void            shmrelease(struct vma*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -156,9 +202,16 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(void);
+void            swapfree(uint);
+void            swapread(uint, char*);
+int             swapout(void);
+
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argoutptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -184,17 +237,35 @@ void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
+int             allocuvm_pse(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*, uint*);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 
 pte_t *         walkpgdir(pde_t * pgdir, const void * va, int alloc);
+int             mapshared(pde_t*, uint, char**, int, int);
+struct vma*     vmaalloc(struct proc*, uint, int);
+struct vma*     vmalookup(struct proc*, uint);
+int             vmadetach(struct proc*, uint, uint, int, struct vma*);
+uint            vmabase(struct proc*);
+int             vmadup(struct proc*, struct proc*);
+void            vmaclear(struct proc*);
+void            vmhold(pde_t*);
+void            vmput(struct proc*);
+int             mmap(struct file*, uint, uint, int, int);
+int             munmap(uint, uint);
+int             msync(uint, uint);
+int             pagefault(uint, uint);
+int             uvmpagein(struct proc*, uint, uint);
+struct vmacct*  vmacct(pde_t*);
+struct vmspace* vmspace(pde_t*);
+void            vmcount(pde_t*, int, int, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -2,27 +2,19 @@
 #include "stat.h"
 #include "user.h"
 #include "syscall.h"
+#include "memlayout.h"
 
 #define PGSIZE 4096
+#define STACKDUMP PGSIZE  // the stack grows down from USTACKTOP
 
 /**
  * My dump function, dump memory from kernel stack
  */
-int myprint(char * buffer, uint sz, uint guardP){
+int myprint(char * buffer, uint base, uint sz){
 	// print
-	printf(1, "print starting:\nData and text region:\n");
 	uint i = 0;
 	for (; i < sz;i += 16) {
-		if(i == guardP){
-			printf(1, "Below is heap region\n Above is Guard page region\n");
-		}
-		if(i == guardP + PGSIZE){
-			printf(1, "Stack region:\n");
-		}
-	//	if(i == guardP - PGSIZE){
-	//		printf(1, "Heap region\n");
-	//	}
-		printf(1, "%p: ", i);
+		printf(1, "%p: ", base + i);
 		printf(1, "\t0x%p ", *(uint *)(buffer + i));
 		printf(1, "\t0x%p ", *(uint *)(buffer + i + 4));
 		printf(1, "\t0x%p ", *(uint *)(buffer + i + 8));
@@ -48,18 +40,23 @@ int mydumper() {
 	}else{
 	printf(1,"parent mydump");
 	
-	/* parent dumps memory of the child */
-	char * buffer = (char*) malloc(buffersize + sizeof(uint));
-	uint addr = 0x0;
-	memset(buffer, 0, buffersize + sizeof(uint));
+	/* parent dumps memory of the child: the image [0, sz), then
+	   the top of the stack, which sits apart at USTACKTOP */
+	char * buffer = (char*) malloc(buffersize > STACKDUMP ? buffersize : STACKDUMP);
+	memset(buffer, 0, buffersize);
 	printf(1, "mydump: start dump");
-	if (dump(pid, (char*) &addr, buffer, buffersize) != 0) {
+	if (dump(pid, (char*) 0, buffer, buffersize) != 0) {
 		printf(1, "dump: fail to dump");
+	} else {
+		printf(1, "print starting:\nText, data and heap region:\n");
+		myprint(buffer, 0, buffersize);
+	}
+	if (dump(pid, (char*) (USTACKTOP - STACKDUMP), buffer, STACKDUMP) != 0) {
+		printf(1, "dump: fail to dump stack");
+	} else {
+		printf(1, "Stack region (top page):\n");
+		myprint(buffer, USTACKTOP - STACKDUMP, STACKDUMP);
 	}
-//	printf(1, "dump: print start");
-	uint guardP;
-	memmove(&guardP, buffer + buffersize, sizeof(uint));
-	myprint(buffer, buffersize, guardP);
 	free(buffer);
 	}
 	return 0;
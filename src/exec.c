@@ -6,6 +6,7 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "fcntl.h"
 
 /**
  * exec:
@@ -20,7 +21,8 @@ int exec(char *path, char **argv) {
 	struct elfhdr elf;
 	struct inode *ip;
 	struct proghdr ph;
-	pde_t *pgdir, *oldpgdir;
+	struct vma *v;
+	pde_t *pgdir;
 	struct proc *curproc = myproc();
 
 	// write inode file into elf
@@ -45,6 +47,8 @@ int exec(char *path, char **argv) {
 	// allocate a format pgdir
 	if ((pgdir = setupkvm()) == 0)
 		goto bad;
+	// the resident page limit stays across exec
+	vmacct(pgdir)->rsslimit = vmacct(curproc->pgdir)->rsslimit;
 
 	// Load program data into memory.
 	sz = 0;
@@ -57,6 +61,9 @@ int exec(char *path, char **argv) {
 			goto bad;
 		if (ph.vaddr + ph.memsz < ph.vaddr)
 			goto bad;
+		// the image stays below the mappings (see vmaalloc)
+		if (ph.vaddr + ph.memsz > MMAPTOP)
+			goto bad;
 		// growth process's size
 		if ((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
 			goto bad;
@@ -73,19 +80,15 @@ int exec(char *path, char **argv) {
 
 	ip = 0;
 
-	// Allocate two align pages at the next page boundary.
-	// Make the first inaccessible.  Use the second as the user stack.
+	// The heap starts at the next page boundary.
 	sz = PGROUNDUP(sz);
-	if ((sz = allocuvm(pgdir, sz, sz + 2 * PGSIZE)) == 0)
-		goto bad;
-
-	// setup guard page
-	// now the sz at the end of process
-	// mark the first page inaccessible, it need to - 2 PGSIZE
-	clearpteu(pgdir, (char*) (sz - 2 * PGSIZE));
 
-	// stack point to sz
-	sp = sz;
+	// Allocate the top page of the user stack, for the arguments.
+	// The rest of its USTACKMAX is filled in as the stack grows down
+	// into it (see pagefault); a fault below that kills the process.
+	if (allocuvm(pgdir, USTACKTOP - PGSIZE, USTACKTOP) == 0)
+		goto bad;
+	sp = USTACKTOP;
 
 	// Push argument strings into user stack, prepare rest of stack in ustack.
 	for (argc = 0; argv[argc]; argc++) {
@@ -113,20 +116,23 @@ int exec(char *path, char **argv) {
 	safestrcpy(curproc->name, last, sizeof(curproc->name));
 
 	// Commit to the user image.
-	// give the old pgdir to local
-	oldpgdir = curproc->pgdir;
-	// load new pgdir made by above steps into current process
-	// the new pgdir is a page belong to old pgdir
-	curproc->pgdir = pgdir;
+	// the old mappings go with the old image (writing back
+	// shared file mappings from the old pgdir), unless threads
+	// still run in it
+	vmput(curproc);
+	v = &vmspace(pgdir)->vma[0];
+	v->type = VMA_STACK;
+	v->start = USTACKTOP - USTACKMAX;
+	v->end = USTACKTOP;
+	v->prot = PROT_READ | PROT_WRITE;
+	v->flags = MAP_PRIVATE;
 	curproc->sz = sz;
 	curproc->tf->eip = elf.entry;  // main
 	curproc->tf->esp = sp;
 
-	// attention: crucial step-- switchuvm()
-	switchuvm(curproc);
-
-	// don't forget recycle memory
-	freevm(oldpgdir);
+	// load the new pgdir into the current process, and free the
+	// old one (attention: crucial step-- switchuvm())
+	setpgdir(curproc, pgdir);
 	return 0;
 
 	bad: if (pgdir)
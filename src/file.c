@@ -12,6 +12,16 @@
 
 struct devsw devsw[NDEV];
 
+// Bytes to write to a file per transaction, so that the blocks
+// logged fit in MAXOPBLOCKS: i-node, indirect block, allocation
+// blocks, and, if file data goes through the log, the data blocks
+// with 2 blocks of slop for non-aligned writes.
+#ifdef LOGDATA
+#define WRITEMAX (((MAXOPBLOCKS - 1 - 1 - 2) / 2) * 512)
+#else
+#define WRITEMAX (NWDATA * 512)
+#endif
+
 // a global cache for current using files and supply file index for every file descriptor table
 struct {
 	struct spinlock lock;
@@ -98,14 +108,60 @@ int fileread(struct file *f, char *addr, int n) {
 	// if it is inode
 	if (f->type == FD_INODE) {
 		ilock(f->ip);
-		if ((r = readi(f->ip, addr, f->off, n)) > 0)
+		if ((r = readi(f->ip, addr, f->off, n)) > 0) {
+			readahead(f->ip, &f->ra, f->off, r);
 			f->off += r;
+		}
 		iunlock(f->ip);
 		return r;
 	}
 	panic("fileread");
 }
 
+// Read n bytes at offset off of inode file f into kernel memory
+// at addr, leaving f->off alone. Returns the bytes read, or -1.
+int filereadat(struct file *f, char *addr, uint off, int n) {
+	int r;
+
+	if (f->type != FD_INODE)
+		return -1;
+	ilock(f->ip);
+	r = readi(f->ip, addr, off, n);
+	iunlock(f->ip);
+	return r;
+}
+
+// Write n bytes at kernel address addr to inode file f at offset
+// off, leaving f->off alone, a few blocks per transaction as in
+// filewrite(). Never grows the file: bytes past its end are
+// dropped. Returns the bytes written, or -1.
+int filewriteat(struct file *f, char *addr, uint off, int n) {
+	int r, i, n1;
+	int max = WRITEMAX;
+
+	if (f->type != FD_INODE)
+		return -1;
+	for (i = 0; i < n; i += r) {
+		n1 = n - i;
+		if (n1 > max)
+			n1 = max;
+		begin_op();
+		ilock(f->ip);
+		if (off + i >= f->ip->size)
+			n1 = 0;
+		else if (n1 > f->ip->size - off - i)
+			n1 = f->ip->size - off - i;
+		r = n1 > 0 ? writei(f->ip, addr + i, off + i, n1) : 0;
+		iunlock(f->ip);
+		end_op();
+		if (r < 0)
+			return -1;
+		if (r == 0)
+			break;
+	}
+	return i;
+}
+
 //PAGEBREAK!
 // Write to file f.
 int filewrite(struct file *f, char *addr, int n) {
@@ -119,12 +175,10 @@ int filewrite(struct file *f, char *addr, int n) {
 	// write file
 	if (f->type == FD_INODE) {
 		// write a few blocks at a time to avoid exceeding
-		// the maximum log transaction size, including
-		// i-node, indirect block, allocation blocks,
-		// and 2 blocks of slop for non-aligned writes.
+		// the maximum log transaction size (see WRITEMAX).
 		// this really belongs lower down, since writei()
 		// might be writing a device like the console.
-		int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * 512;
+		int max = WRITEMAX;
 		int i = 0;
 		while (i < n) {
 			int n1 = n - i;
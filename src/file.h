@@ -1,3 +1,10 @@
+// Sequential readahead state of an open file (see readahead)
+struct rastate {
+	uint next;   // block a sequential read would start in
+	uint ahead;  // blocks up to here have been read ahead
+	uint win;    // blocks to keep read ahead; 0 if not sequential
+};
+
 // the unnamed file
 struct file {
 	// is this file a inode, or pipe, or none
@@ -10,6 +17,7 @@ struct file {
 	struct pipe *pipe;
 	struct inode *ip; // inode pointer
 	uint off; // current offset of inode, represent last read progress
+	struct rastate ra;
 };
 
 // in-memory copy of an inode
@@ -20,6 +20,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "iostat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -36,21 +37,51 @@ void readsb(int dev, struct superblock *sb) {
 	brelse(bp);
 }
 
-// Zero a block.
-static void bzero(int dev, int bno) {
+// Which kind of block (IO_*) is block blockno of dev?
+int blocktype(uint dev, uint blockno) {
+	if (dev != ROOTDEV || sb.size == 0 || blockno < sb.logstart)
+		return IO_OTHER;
+	if (blockno < sb.inodestart)
+		return IO_LOG;
+	if (blockno < sb.bmapstart)
+		return IO_INODE;
+	if (blockno < sb.size - sb.nblocks)
+		return IO_BITMAP;
+	return IO_DATA;
+}
+
+// Does the file data of ip bypass the log? In ordered mode (the
+// default; build with -DLOGDATA to log it too) writei() writes the
+// blocks of plain files straight home, before the transaction that
+// points to them commits; only metadata goes through the log.
+static int ordered(struct inode *ip) {
+#ifdef LOGDATA
+	return 0;
+#else
+	return ip->type == T_FILE;
+#endif
+}
+
+// Zero a block. A data block that bypasses the log is only zeroed
+// in the cache, where B_DIRTY holds it until writei() writes it.
+static void bzero(int dev, int bno, int data) {
 	struct buf *bp;
 
-	bp = bread(dev, bno);
+	bp = bget_blank(dev, bno);  // no need to read what is zeroed
 	memset(bp->data, 0, BSIZE);
-	log_write(bp);
+	if (data)
+		bp->flags |= B_DIRTY;
+	else
+		log_write(bp);
 	brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block, for data bypassing the log if
+// data is set: then not one the log may still write (log_pending).
 // return a block address
-static uint balloc(uint dev) {
+static uint balloc(uint dev, int data) {
 	int b, bi, m;
 	struct buf *bp;
 
@@ -61,7 +92,8 @@ static uint balloc(uint dev) {
 		// scan current buffer to look up a bit
 		for (bi = 0; bi < BPB && b + bi < sb.size; bi++) {
 			m = 1 << (bi % 8);
-			if ((bp->data[bi / 8] & m) == 0) {  // Is block free?
+			// Is block free?
+			if ((bp->data[bi / 8] & m) == 0 && !(data && log_pending(b + bi))) {
 				// mark block
 				bp->data[bi / 8] |= m;  // Mark block in use.
 				// synchronize to disk
@@ -69,7 +101,7 @@ static uint balloc(uint dev) {
 				// release buffer
 				brelse(bp);
 				// initial this block
-				bzero(dev, b + bi);
+				bzero(dev, b + bi, data);
 				// return block address, also known as global block number
 				return b + bi;
 			}
@@ -93,6 +125,9 @@ static void bfree(int dev, uint b) {
 	bp->data[bi / 8] &= ~m;
 	log_write(bp);
 	brelse(bp);
+#ifndef LOGDATA
+	log_free(b);  // not to be reused for data until this commits
+#endif
 }
 
 // Inodes.
@@ -373,7 +408,7 @@ static uint bmap(struct inode *ip, uint bn) {
 		// if address not allocated
 		// load indirect block
 		if ((addr = ip->addrs[bn]) == 0)
-			ip->addrs[bn] = addr = balloc(ip->dev);
+			ip->addrs[bn] = addr = balloc(ip->dev, ordered(ip));
 		return addr;
 	}
 	bn -= NDIRECT;
@@ -387,7 +422,7 @@ static uint bmap(struct inode *ip, uint bn) {
 		// load indirect block
 		// Load indirect block, allocating if necessary.
 		if ((addr = ip->addrs[NDIRECT]) == 0)
-			ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+			ip->addrs[NDIRECT] = addr = balloc(ip->dev, 0);
 
 		// load block into buffer and get the buffer point
 		// replace bp with new data from current bmap
@@ -398,7 +433,7 @@ static uint bmap(struct inode *ip, uint bn) {
 		// if address not allocated
 		// load indirect block
 		if ((addr = a[bn]) == 0) {
-			a[bn] = addr = balloc(ip->dev);
+			a[bn] = addr = balloc(ip->dev, ordered(ip));
 			// because before read buffer, so now write into buffer by the way.
 			log_write(bp);
 		}
@@ -410,6 +445,23 @@ static uint bmap(struct inode *ip, uint bn) {
 	panic("bmap: out of range");
 }
 
+// Like bmap(), but never allocate: return 0 if the nth block
+// of ip has no disk block.
+static uint bpeek(struct inode *ip, uint bn) {
+	uint addr;
+	struct buf *bp;
+
+	if (bn < NDIRECT)
+		return ip->addrs[bn];
+	bn -= NDIRECT;
+	if (bn >= NINDIRECT || (addr = ip->addrs[NDIRECT]) == 0)
+		return 0;
+	bp = bread(ip->dev, addr);
+	addr = ((uint*) bp->data)[bn];
+	brelse(bp);
+	return addr;
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -487,12 +539,85 @@ int readi(struct inode *ip, char *dst, uint off, uint n) {
 	return n;
 }
 
+// Start reading blocks [bn, bn+n) of ip into the buffer cache,
+// without waiting for them, those next to each other on disk
+// together. Caller must hold ip->lock.
+void ireadahead(struct inode *ip, uint bn, uint n) {
+	uint addr, end, start, nrun;
+
+	end = (ip->size + BSIZE - 1) / BSIZE;
+	if (bn >= end)
+		return;
+	if (n < end - bn)
+		end = bn + n;
+	start = nrun = 0;
+	for (; bn < end; bn++) {
+		addr = bpeek(ip, bn);
+		if (nrun > 0 && addr != start + nrun) {
+			breadahead(ip->dev, start, nrun);
+			nrun = 0;
+		}
+		if (addr == 0)
+			continue;
+		if (nrun++ == 0)
+			start = addr;
+	}
+	if (nrun > 0)
+		breadahead(ip->dev, start, nrun);
+}
+
+// Read ahead for an open file after it read n bytes at off of ip.
+// A read that starts where the last one ended is sequential and
+// doubles the window, up to RAMAX blocks; any other read closes
+// it. Blocks are read ahead a window at a time, once less than
+// half a window of them is left. Caller must hold ip->lock.
+void readahead(struct inode *ip, struct rastate *ra, uint off, uint n) {
+	uint bn, end;
+
+	if (n == 0 || ip->type == T_DEV)
+		return;
+	bn = off / BSIZE;
+	end = (off + n - 1) / BSIZE + 1;  // past the last block read
+	if (bn == ra->next) {
+		ra->win = ra->win ? ra->win * 2 : 4;
+		if (ra->win > RAMAX)
+			ra->win = RAMAX;
+	} else {
+		ra->win = 0;
+		ra->ahead = 0;
+	}
+	ra->next = (off + n) / BSIZE;
+	if (ra->win == 0 || ra->ahead > end + ra->win / 2)
+		return;
+	if (ra->ahead < end)
+		ra->ahead = end;
+	ireadahead(ip, ra->ahead, end + ra->win - ra->ahead);
+	ra->ahead = end + ra->win;
+}
+
+// Write locked file data blocks bs[0..n) home, past the log,
+// consecutive ones with one request, and release them.
+static void wdata(struct buf **bs, int n) {
+	int i, j;
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && bs[j]->blockno == bs[j - 1]->blockno + 1; j++)
+			;
+		bwrite_range(&bs[i], j - i);
+	}
+	for (i = 0; i < n; i++) {
+		bwait(bs[i]);
+		brelse(bs[i]);
+	}
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
 int writei(struct inode *ip, char *src, uint off, uint n) {
 	uint tot, m;
-	struct buf *bp;
+	struct buf *bp, *bs[NWDATA];
+	int nbs;
 
 	if (ip->type == T_DEV) {
 		if (ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -505,13 +630,24 @@ int writei(struct inode *ip, char *src, uint off, uint n) {
 	if (off + n > MAXFILE * BSIZE)
 		return -1;
 
+	nbs = 0;
 	for (tot = 0; tot < n; tot += m, off += m, src += m) {
 		bp = bread(ip->dev, bmap(ip, off / BSIZE));
 		m = min(n - tot, BSIZE - off%BSIZE);
 		memmove(bp->data + off % BSIZE, src, m);
-		log_write(bp);
-		brelse(bp);
+		if (ordered(ip)) {
+			// home before the transaction commits
+			bs[nbs++] = bp;
+			if (nbs == NWDATA) {
+				wdata(bs, nbs);
+				nbs = 0;
+			}
+		} else {
+			log_write(bp);
+			brelse(bp);
+		}
 	}
+	wdata(bs, nbs);
 
 	if (n > 0 && off > ip->size) {
 		ip->size = off;
@@ -12,6 +12,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,15 +24,23 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+
+#define IDEMULT       16  // sectors per interrupt in multiple mode
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
 // You must hold idelock while manipulating queue.
+// A request may cover several bufs of consecutive blocks: the
+// rest of them follow the queued one through rnext.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
 
+static struct iostat iostat;  // disk counters, under idelock
+
 static int havedisk1;
+static int idemaxrun = 1;  // most blocks in one request
 static void idestart(struct buf*);
 
 // Wait for IDE disk to become ready.
@@ -61,34 +70,50 @@ void ideinit(void) {
 		}
 	}
 
+	// Transfer up to IDEMULT sectors per command and interrupt.
+	idemaxrun = IDEMULT / (BSIZE / SECTOR_SIZE);
+	for (i = 0; i <= havedisk1; i++) {
+		outb(0x1f6, 0xe0 | (i << 4));
+		outb(0x1f2, IDEMULT);
+		outb(0x1f7, IDE_CMD_SETMUL);
+		if (idewait(1) < 0)
+			idemaxrun = 1;
+	}
+
 	// Switch back to disk 0.
 	outb(0x1f6, 0xe0 | (0 << 4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b and the bufs after it through rnext.
+// Caller must hold idelock.
 static void idestart(struct buf *b) {
+	struct buf *r;
+	int n;
+
 	if (b == 0)
 		panic("idestart");
-	if (b->blockno >= FSSIZE)
-		panic("incorrect blockno");
+	for (n = 0, r = b; r; r = r->rnext)
+		n++;
 	int sector_per_block = BSIZE / SECTOR_SIZE;
 	int sector = b->blockno * sector_per_block;
-	int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ : IDE_CMD_RDMUL;
-	int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+	int nsector = n * sector_per_block;
+	int read_cmd = (nsector == 1) ? IDE_CMD_READ : IDE_CMD_RDMUL;
+	int write_cmd = (nsector == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-	if (sector_per_block > 7)
+	if (sector_per_block > 7 || nsector > 255)
 		panic("idestart");
 
 	idewait(0);
 	outb(0x3f6, 0);  // generate interrupt
-	outb(0x1f2, sector_per_block);  // number of sectors
+	outb(0x1f2, nsector);  // number of sectors
 	outb(0x1f3, sector & 0xff);
 	outb(0x1f4, (sector >> 8) & 0xff);
 	outb(0x1f5, (sector >> 16) & 0xff);
 	outb(0x1f6, 0xe0 | ((b->dev & 1) << 4) | ((sector >> 24) & 0x0f));
 	if (b->flags & B_DIRTY) {
 		outb(0x1f7, write_cmd);
-		outsl(0x1f0, b->data, BSIZE / 4);
+		for (r = b; r; r = r->rnext)
+			outsl(0x1f0, r->data, BSIZE / 4);
 	} else {
 		outb(0x1f7, read_cmd);
 	}
@@ -96,7 +121,8 @@ static void idestart(struct buf *b) {
 
 // Interrupt handler.
 void ideintr(void) {
-	struct buf *b;
+	struct buf *b, *r, *next, *done;
+	void (*iodone)(struct buf*);
 
 	// First queued buffer is the active request.
 	acquire(&idelock);
@@ -109,51 +135,134 @@ void ideintr(void) {
 
 	// Read data if needed.
 	if (!(b->flags & B_DIRTY) && idewait(1) >= 0)
-		insl(0x1f0, b->data, BSIZE / 4);
+		for (r = b; r; r = r->rnext)
+			insl(0x1f0, r->data, BSIZE / 4);
 
-	// Wake process waiting for this buf.
-	b->flags |= B_VALID;
-	b->flags &= ~B_DIRTY;
-	wakeup(b);
+	// Wake processes waiting for these bufs.
+	done = 0;
+	for (r = b; r; r = next) {
+		next = r->rnext;
+		r->flags |= B_VALID;
+		r->flags &= ~(B_DIRTY | B_ASYNC);
+		if (r->iodone) {
+			r->rnext = done;
+			done = r;
+		} else
+			wakeup(r);
+	}
 
 	// Start disk on next buf in queue.
 	if (idequeue != 0)
 		idestart(idequeue);
 
 	release(&idelock);
+	// iodone may release its buf, so call it without idelock
+	for (r = done; r; r = next) {
+		next = r->rnext;
+		iodone = r->iodone;
+		r->iodone = 0;
+		iodone(r);
+	}
 }
 
 //PAGEBREAK!
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// With B_ASYNC, only start the request: iderwait() waits for it,
+// or ideintr() calls b->iodone when it completes.
 void iderw(struct buf *b) {
-	struct buf **pp;
+	iderwn(&b, 1);
+}
+
+// Sync n bufs of consecutive blocks on one device with disk, like
+// iderw(), in as few disk commands as the disk allows. All must
+// be reads or all writes, and all B_ASYNC or none.
+void iderwn(struct buf **bs, int n) {
+	struct buf *b, **pp;
+	uint start;
+	int i, j;
 
-	if (!holdingsleep(&b->lock))
-		panic("iderw: buf not locked");
-	if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID)
-		panic("iderw: nothing to do");
-	if (b->dev != 0 && !havedisk1)
-		panic("iderw: ide disk 1 not present");
+	for (i = 0; i < n; i++) {
+		b = bs[i];
+		if (!holdingsleep(&b->lock))
+			panic("iderw: buf not locked");
+		if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID)
+			panic("iderw: nothing to do");
+		if (b->dev != 0 && !havedisk1)
+			panic("iderw: ide disk 1 not present");
+		if (b->dev != SWAPDEV && b->blockno >= FSSIZE)
+			panic("incorrect blockno");
+		if (i > 0 && (b->dev != bs[0]->dev || b->blockno != bs[i - 1]->blockno + 1
+				|| (b->flags & (B_DIRTY | B_ASYNC)) != (bs[0]->flags & (B_DIRTY | B_ASYNC))))
+			panic("iderwn: not a run");
+	}
 
 	acquire(&idelock);  //DOC:acquire-lock
 
-	// Append b to idequeue.
-	b->qnext = 0;
-	for (pp = &idequeue; *pp; pp = &(*pp)->qnext)
-		//DOC:insert-queue
-		;
-	*pp = b;
+	for (i = 0; i < n; i = j) {
+		// one request for up to idemaxrun blocks
+		for (j = i; j < n && j - i < idemaxrun; j++) {
+			b = bs[j];
+			b->rnext = (j + 1 < n && j + 1 - i < idemaxrun) ? bs[j + 1] : 0;
+			if (b->flags & B_DIRTY) {
+				iostat.writes++;
+				iostat.wblocks[blocktype(b->dev, b->blockno)]++;
+			} else {
+				iostat.reads++;
+				iostat.rblocks[blocktype(b->dev, b->blockno)]++;
+			}
+		}
 
-	// Start disk if necessary.
-	if (idequeue == b)
-		idestart(b);
+		// Append bs[i] to idequeue.
+		bs[i]->qnext = 0;
+		for (pp = &idequeue; *pp; pp = &(*pp)->qnext)
+			//DOC:insert-queue
+			;
+		*pp = bs[i];
 
-	// Wait for request to finish.
-	while ((b->flags & (B_VALID | B_DIRTY)) != B_VALID) {
-		sleep(b, &idelock);
+		// Start disk if necessary.
+		if (idequeue == bs[i])
+			idestart(bs[i]);
+	}
+
+	if ((bs[0]->flags & B_ASYNC) == 0) {
+		// Wait for requests to finish.
+		start = ticks;
+		for (i = 0; i < n; i++)
+			while ((bs[i]->flags & (B_VALID | B_DIRTY)) != B_VALID)
+				sleep(bs[i], &idelock);
+		iostat.waitticks += ticks - start;
 	}
 
 	release(&idelock);
 }
+
+// Wait for the B_ASYNC request on b, if any, to finish.
+// b->iodone must not be set. ideintr() clears B_ASYNC; a cached
+// buffer with no request queued, dirty or not, returns at once.
+void iderwait(struct buf *b) {
+	uint start;
+
+	acquire(&idelock);
+	start = ticks;
+	while (b->flags & B_ASYNC)
+		sleep(b, &idelock);
+	iostat.waitticks += ticks - start;
+	release(&idelock);
+}
+
+// Fill in the disk counters of st.
+void idestat(struct iostat *st) {
+	int i;
+
+	acquire(&idelock);
+	st->reads = iostat.reads;
+	st->writes = iostat.writes;
+	st->waitticks = iostat.waitticks;
+	for (i = 0; i < NIOTYPE; i++) {
+		st->rblocks[i] = iostat.rblocks[i];
+		st->wblocks[i] = iostat.wblocks[i];
+	}
+	release(&idelock);
+}
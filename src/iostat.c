@@ -0,0 +1,57 @@
+// Report buffer cache and disk activity: iostat [interval [count]]
+// prints the totals since boot, then, every interval ticks, what
+// happened since the last report, count times (or forever).
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "iostat.h"
+
+static void
+report(struct iostat *st, struct iostat *last)
+{
+  uint hits, misses;
+
+  hits = st->hits - last->hits;
+  misses = st->misses - last->misses;
+  printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d/%d\t%d/%d\t%d/%d\t%d/%d\n",
+         st->nbuf, hits, misses,
+         hits + misses > 0 ? hits * 100 / (hits + misses) : 0,
+         st->evictions - last->evictions, st->dirty,
+         st->reads - last->reads, st->writes - last->writes,
+         st->waitticks - last->waitticks,
+         st->rblocks[IO_LOG] - last->rblocks[IO_LOG],
+         st->wblocks[IO_LOG] - last->wblocks[IO_LOG],
+         st->rblocks[IO_INODE] - last->rblocks[IO_INODE],
+         st->wblocks[IO_INODE] - last->wblocks[IO_INODE],
+         st->rblocks[IO_BITMAP] - last->rblocks[IO_BITMAP],
+         st->wblocks[IO_BITMAP] - last->wblocks[IO_BITMAP],
+         st->rblocks[IO_DATA] - last->rblocks[IO_DATA],
+         st->wblocks[IO_DATA] - last->wblocks[IO_DATA]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct iostat st, last;
+  int interval, count, i;
+
+  interval = argc > 1 ? atoi(argv[1]) : 0;
+  count = argc > 2 ? atoi(argv[2]) : -1;
+
+  memset(&last, 0, sizeof(last));
+  printf(1, "bufs\thits\tmisses\thit%%\tevict\tdirty\treads\twrites\twait"
+         "\tlog r/w\tinode r/w\tbitmap r/w\tdata r/w\n");
+  for(i = 0; ; i++){
+    if(iostat(&st) < 0){
+      printf(2, "iostat: iostat failed\n");
+      exit();
+    }
+    report(&st, &last);
+    last = st;
+    if(interval <= 0 || (count >= 0 && i + 1 >= count))
+      break;
+    sleep(interval);
+  }
+  exit();
+}
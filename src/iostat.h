@@ -0,0 +1,20 @@
+// Kinds of disk block, by where they are in the file system.
+#define IO_LOG     0  // log header and blocks
+#define IO_INODE   1  // inode blocks
+#define IO_BITMAP  2  // free block bitmap
+#define IO_DATA    3  // file and directory contents, indirect blocks
+#define IO_OTHER   4  // boot block, superblock, swap
+#define NIOTYPE    5
+
+struct iostat {
+  uint nbuf;       // buffers in the cache
+  uint hits;       // bread()s of a cached block
+  uint misses;     // bread()s that had to read the disk
+  uint evictions;  // cached blocks recycled for another
+  uint dirty;      // buffers the log has pinned, now
+  uint reads;      // disk reads
+  uint writes;     // disk writes
+  uint waitticks;  // ticks processes have waited for the disk
+  uint rblocks[NIOTYPE];  // disk reads of each kind of block
+  uint wblocks[NIOTYPE];  // disk writes of each kind of block
+};
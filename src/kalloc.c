@@ -1,6 +1,29 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, or physically
+// contiguous blocks of 2^order pages.
+//
+// This is a buddy allocator. Free memory is kept as blocks of
+// 2^order pages, 0 <= order <= KMAXORDER, each aligned to its own
+// size in physical memory, on one free list per order. The buddy
+// of a block is the block of the same order it was split from,
+// found by flipping bit order of its page number; when a block is
+// freed and its buddy is free too, the two are merged into one
+// block of the next order, and so on up.
+//
+// Memory handed over at boot is not put on the free lists page by
+// page: freerange() only records it as an untouched extent, and
+// kalloc_order() carves the largest aligned blocks it can out of
+// the extents when the free lists run dry.
+//
+// A page can be mapped by several page tables at once (shared
+// memory). kincref() counts each extra mapping, and kfree() of
+// such a page drops one reference instead of freeing it.
+//
+// Freed pages are not cleared (build with -DKJUNK to fill them
+// with junk, to catch dangling references). Callers that need a
+// zeroed page use kalloc_zeroed(), which takes one from a pool
+// that the kzerod kernel thread fills while the CPUs are idle.
 
 #include "types.h"
 #include "defs.h"
@@ -13,26 +36,99 @@ void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+#define KFREE   0x80                // kmem.info[]: page heads a free block
+#define NLAZY   2                   // untouched extents: kinit1's and kinit2's
+
+uint phystop;  // top of physical memory, set by physinit()
+
+// Header kept in the first bytes of every free block.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run free[KMAXORDER+1]; // circular free list heads, per order
+  int nfree[KMAXORDER+1];       // blocks on each free list
+  uint npage;                   // physical pages, phystop/PGSIZE
+  uchar *info;                  // per page: KFREE|order for the first page of a free block
+  ushort *ref;                  // per page: references beyond the first
+  uint lazylo[NLAZY];           // untouched extents, as page numbers [lo, hi)
+  uint lazyhi[NLAZY];
 } kmem;
 
+struct {
+  struct spinlock lock;
+  struct run *list;             // zeroed pages, linked through next
+  int n;                        // pages on list
+} kzero;
+
+// An entry of the BIOS memory map.
+struct e820 {
+  uint addr, addrhi;
+  uint len, lenhi;
+  uint type;
+};
+#define E820_RAM  1
+
+// Find the top of physical memory in the BIOS E820 map that
+// bootasm.S left at E820MAP: the end of the usable range that
+// holds EXTMEM, up to MAXPHYS. Without a map, use PHYSTOP.
+void
+physinit(void)
+{
+  struct e820 *e, *eend;
+  uint top;
+
+  e = (struct e820*)P2V(E820MAP + 4);
+  eend = (struct e820*)P2V((uint)*(ushort*)P2V(E820MAP));
+  phystop = PHYSTOP;
+  if(eend < e || eend > e + 64 || ((char*)eend - (char*)e) % sizeof(*e))
+    return;  // not a map bootasm.S wrote
+  for(; e < eend; e++){
+    if(e->type != E820_RAM || e->addrhi != 0 || e->addr > EXTMEM)
+      continue;
+    top = e->addr + e->len;
+    if(e->lenhi != 0 || top < e->addr || top > MAXPHYS)
+      top = MAXPHYS;
+    if(top > EXTMEM)
+      phystop = PGROUNDDOWN(top);
+  }
+  if(phystop < 4*1024*1024)
+    panic("physinit");
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// The per-page arrays, sized by phystop, take the first pages
+// from vstart on.
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+  char *p;
+
+  kmem.npage = phystop / PGSIZE;
+  p = (char*)vstart;
+  kmem.info = (uchar*)p;
+  p += kmem.npage * sizeof(kmem.info[0]);
+  kmem.ref = (ushort*)PGROUNDUP((uint)p);
+  p = (char*)kmem.ref + kmem.npage * sizeof(kmem.ref[0]);
+  if(p > (char*)vend)
+    panic("kinit1");
+  memset(vstart, 0, p - (char*)vstart);
+  vstart = p;
+
   initlock(&kmem.lock, "kmem");
+  initlock(&kzero.lock, "kzero");
   kmem.use_lock = 0;
+  for(i = 0; i <= KMAXORDER; i++)
+    kmem.free[i].next = kmem.free[i].prev = &kmem.free[i];
   freerange(vstart, vend);
 }
 
@@ -43,37 +139,193 @@ kinit2(void *vstart, void *vend)
   kmem.use_lock = 1;
 }
 
+// Record [vstart, vend) as an untouched extent of free memory.
 void
 freerange(void *vstart, void *vend)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
-    kfree(p);
+  int i;
+
+  for(i = 0; i < NLAZY; i++)
+    if(kmem.lazylo[i] == kmem.lazyhi[i])
+      break;
+  if(i == NLAZY)
+    panic("freerange");
+  kmem.lazylo[i] = V2P(PGROUNDUP((uint)vstart)) >> PGSHIFT;
+  kmem.lazyhi[i] = V2P(PGROUNDDOWN((uint)vend)) >> PGSHIFT;
+  if(kmem.lazylo[i] > kmem.lazyhi[i])
+    kmem.lazylo[i] = kmem.lazyhi[i];
+}
+
+// Put block r of the given order on its free list.
+// Caller must hold kmem.lock.
+static void
+pushblock(struct run *r, int order)
+{
+  struct run *h = &kmem.free[order];
+
+  r->next = h->next;
+  r->prev = h;
+  h->next->prev = r;
+  h->next = r;
+  kmem.info[V2P(r) >> PGSHIFT] = KFREE | order;
+  kmem.nfree[order]++;
+}
+
+// Take block r of the given order off its free list.
+// Caller must hold kmem.lock.
+static void
+unlinkblock(struct run *r, int order)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kmem.info[V2P(r) >> PGSHIFT] = 0;
+  kmem.nfree[order]--;
+}
+
+// Order of the largest block that starts at page lo, is aligned
+// to its size, and ends by page hi.
+static int
+carveorder(uint lo, uint hi)
+{
+  int o;
+
+  for(o = KMAXORDER; o > 0; o--)
+    if(lo % (1 << o) == 0 && lo + (1 << o) <= hi)
+      break;
+  return o;
 }
+
+// Move the next block of an untouched extent onto its free list.
+// Returns 0 if all memory has been touched.
+// Caller must hold kmem.lock.
+static int
+carve(void)
+{
+  int i, o;
+
+  for(i = 0; i < NLAZY; i++){
+    if(kmem.lazylo[i] == kmem.lazyhi[i])
+      continue;
+    o = carveorder(kmem.lazylo[i], kmem.lazyhi[i]);
+    pushblock((struct run*)P2V(kmem.lazylo[i] << PGSHIFT), o);
+    kmem.lazylo[i] += 1 << o;
+    return 1;
+  }
+  return 0;
+}
+
 //PAGEBREAK: 21
+// Free the block of 2^order pages of physical memory pointed at
+// by v, which normally should have been returned by a call to
+// kalloc_order(order). (The exception is when initializing the
+// allocator; see kinit above.) Any aligned part of a block may
+// be freed on its own, e.g. single pages with kfree().
+void
+kfree_order(char *v, int order)
+{
+  uint pfn, bpfn;
+
+  if(order < 0 || order > KMAXORDER)
+    panic("kfree_order");
+  if(V2P(v) % (PGSIZE << order) || v < end || V2P(v) + (PGSIZE << order) > phystop)
+    panic("kfree");
+
+#ifdef KJUNK
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  pfn = V2P(v) >> PGSHIFT;
+  if(kmem.info[pfn] & KFREE)
+    panic("kfree: double free");
+
+  // Merge with the buddy while it is free and of the same order.
+  for(; order < KMAXORDER; order++){
+    bpfn = pfn ^ (1 << order);
+    if(bpfn >= kmem.npage || kmem.info[bpfn] != (KFREE | order))
+      break;
+    unlinkblock((struct run*)P2V(bpfn << PGSHIFT), order);
+    pfn &= ~(1 << order);
+  }
+  pushblock((struct run*)P2V(pfn << PGSHIFT), order);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
 // Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// or drop one reference to it if it is shared.
 void
 kfree(char *v)
 {
-  struct run *r;
+  uint pfn;
+  int shared;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if(V2P(v) >= phystop)
     panic("kfree");
+  pfn = V2P(v) >> PGSHIFT;
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  shared = kmem.ref[pfn] > 0;
+  if(shared)
+    kmem.ref[pfn]--;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  if(!shared)
+    kfree_order(v, 0);
+}
 
-  // Fill with junk to catch dangling refs.
-  memset(v, 1, PGSIZE);
+// Take another reference to the allocated page v, which
+// will then take one more kfree() to be freed.
+void
+kincref(char *v)
+{
+  if(V2P(v) >= phystop || (uint)v % PGSIZE)
+    panic("kincref");
+  acquire(&kmem.lock);
+  kmem.ref[V2P(v) >> PGSHIFT]++;
+  release(&kmem.lock);
+}
+
+// Allocate a block of 2^order physically contiguous pages,
+// aligned to its size. Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc_order(int order)
+{
+  struct run *r;
+  int o;
+
+  if(order < 0 || order > KMAXORDER)
+    return 0;
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  // Smallest free block that is big enough, carving more out of
+  // the untouched extents if need be.
+  for(;;){
+    for(o = order; o <= KMAXORDER; o++)
+      if(kmem.free[o].next != &kmem.free[o])
+        break;
+    if(o <= KMAXORDER || !carve())
+      break;
+  }
+  if(o > KMAXORDER){
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return 0;
+  }
+  r = kmem.free[o].next;
+  unlinkblock(r, o);
+  // Split it, returning the upper halves to the free lists.
+  while(o > order){
+    o--;
+    pushblock((struct run*)((char*)r + (PGSIZE << o)), o);
+  }
   if(kmem.use_lock)
     release(&kmem.lock);
+  return (char*)r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -84,13 +336,91 @@ kalloc(void)
 {
   struct run *r;
 
+  // Fast path: take a free page as is, without searching or splitting.
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  r = kmem.free[0].next;
+  if(r != &kmem.free[0])
+    unlinkblock(r, 0);
+  else
+    r = 0;
   if(kmem.use_lock)
     release(&kmem.lock);
+  if(r)
+    return (char*)r;
+  return kalloc_order(0);
+}
+
+// Allocate one zeroed page, from the pool if it has one.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  if(kmem.use_lock)
+    acquire(&kzero.lock);
+  if((r = kzero.list) != 0){
+    kzero.list = r->next;
+    kzero.n--;
+  }
+  if(kmem.use_lock)
+    release(&kzero.lock);
+  if(r){
+    r->next = 0;  // the link was the only non-zero word
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
   return (char*)r;
 }
 
+// If the zeroed page pool is low, return the channel kzerod
+// sleeps on, for the scheduler to wake it when it has nothing
+// else to run; otherwise 0.
+void*
+kzerowanted(void)
+{
+  return kzero.n < NZPOOL / 2 ? &kzero : 0;
+}
+
+// Kernel thread that zeroes free pages into the pool, one at a
+// time, yielding to anything else runnable after each.
+void
+kzerod(void)
+{
+  struct run *r;
+
+  for(;;){
+    acquire(&kzero.lock);
+    sleep(&kzero, &kzero.lock);
+    release(&kzero.lock);
+    while(kzero.n < NZPOOL && (r = (struct run*)kalloc()) != 0){
+      memset(r, 0, PGSIZE);
+      acquire(&kzero.lock);
+      r->next = kzero.list;
+      kzero.list = r;
+      kzero.n++;
+      release(&kzero.lock);
+      yield();
+    }
+  }
+}
+
+// Report the number of free blocks of each order in
+// nfree[0..KMAXORDER], for the fragmentation report.
+// Untouched extents count as the blocks they will be carved into.
+void
+kmemstat(int *nfree)
+{
+  int i, o;
+  uint lo;
+
+  acquire(&kmem.lock);
+  for(i = 0; i <= KMAXORDER; i++)
+    nfree[i] = kmem.nfree[i];
+  for(i = 0; i < NLAZY; i++)
+    for(lo = kmem.lazylo[i]; lo < kmem.lazyhi[i]; lo += 1 << o)
+      nfree[o = carveorder(lo, kmem.lazyhi[i])]++;
+  release(&kmem.lock);
+}
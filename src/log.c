@@ -18,22 +18,47 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until logd takes the transaction to commit it.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
+//   header block, containing the first slot in use (tail), the
+//     number of slots in use, and the home block # of each slot
+//   LOGSIZE slots, used as a ring: block A, block B, ...
+// Log appends are synchronous. Consecutive blocks are written
+// with one disk request, and all of a transaction's blocks are
+// queued together and waited for as a batch before the header.
+//
+// Group commit: operations add to the transaction in log.lh
+// while the logd kernel thread commits the one before it. Once
+// no operation is in log.lh, logd copies out the contents of its
+// blocks into the next free slots (begin_op waits meanwhile), so
+// that later operations may change the cached blocks while logd
+// writes the copies to the log. A transaction is committed once
+// the header counting its slots is on disk, and end_op returns
+// then.
+//
+// Checkpointing: committed blocks stay in the log, and pinned in
+// the cache, until the ckptd kernel thread writes them home, once
+// more than half the slots are in use or logd needs more free.
+// Only the latest copy of a block in the log is written home.
+//
+// In ordered mode (see fs.c) file data is written home directly,
+// so a data block must not be one the log may still write home
+// (a checkpoint or recovery would overwrite it), nor one freed by
+// a transaction not yet committed (after a crash, the file that
+// freed it would show the new data). log_pending() tells balloc().
+// Like log space, room to record frees is reserved in begin_op().
+
+#define MAXOPFREE  (MAXFILE + 1)      // max # of blocks any FS op frees
+#define NFREED     (MAXOPFREE * 3)
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
 	int n;
-	int block[LOGSIZE]; // contains max block number per commit
+	int tail;            // first slot in use (on disk)
+	int block[LOGSIZE];  // home block number: of each slot on disk, of each block in lh
 };
 
 struct log {
@@ -41,18 +66,41 @@ struct log {
 	int start; // block number of first log start
 	int size;
 	// how many level of FS sys calls are executing.
-	// every begin_op++, end_op--, once equals to 0 submit operation
+	// every begin_op++, end_op--, once equals to 0 logd may commit
 	int outstanding;
-	int committing;  // in commit(), please wait.
+	int committing;  // logd is copying lh out, please wait.
 	int dev;
-	struct logheader lh;
+	struct logheader lh;  // the transaction operations add to
+	int tail;             // slots [tail, tail+n) hold committed blocks
+	int n;
+	int block[LOGSIZE];   // home block number of each slot
+	int needspace;        // logd waits for ckptd to free slots
+	int ncommit;          // slots after tail+n logd is writing
+	// blocks freed by the transaction in lh (freed[fcur]), and by
+	// the one logd is committing
+	uint freed[2][NFREED];
+	int nfreed[2];
+	int fcur;
+	uint seq;             // number of the transaction in lh
+	uint done;            // number of the last one committed
 };
 struct log log;
 
+// The contents of each slot, and the private bufs through which
+// they go to the log and home, past the buffer cache (the cached
+// blocks may already hold later changes). pin[] are the cached
+// blocks, pinned until written home.
+static uchar ldata[LOGSIZE][BSIZE];
+static struct buf lbuf[LOGSIZE];
+static struct buf *pin[LOGSIZE];
+
 static void recover_from_log(void);
-static void commit();
+static void logd(void);
+static void ckptd(void);
 
 void initlog(int dev) {
+	int i;
+
 	if (sizeof(struct logheader) >= BSIZE)
 		panic("initlog: too big logheader");
 
@@ -62,75 +110,152 @@ void initlog(int dev) {
 	log.start = sb.logstart;
 	log.size = sb.nlog;
 	log.dev = dev;
+	log.seq = 1;
+	if (log.size < LOGSIZE + 1)
+		panic("initlog: log too small");
+	for (i = 0; i < LOGSIZE; i++) {
+		initsleeplock(&lbuf[i].lock, "logbuf");
+		lbuf[i].dev = dev;
+		lbuf[i].data = ldata[i];
+	}
 	recover_from_log();
+	kthread("logd", logd);
+	kthread("ckptd", ckptd);
 }
 
-// Copy committed blocks from log to their home location
-// copy block from log into device data
-static void install_trans(void) {
-	int tail;
-
-	for (tail = 0; tail < log.lh.n; tail++) {
-		struct buf *lbuf = bread(log.dev, log.start + tail + 1); // read log block, read the log block memory
-		struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst, read the truly block memory
-		memmove(dbuf->data, lbuf->data, BSIZE);  // copy truly block data to truly dst data
-		bwrite(dbuf);  // write dst to disk
-		brelse(lbuf);
-		brelse(dbuf);
+// Read (flags 0) or write (B_DIRTY) the slots of bufs bs[0..n),
+// of lbuf[], whose blockno the caller has set, consecutive blocks
+// with one request, and wait for all of them.
+static void lbufrw(struct buf **bs, int n, int flags) {
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		acquiresleep(&bs[i]->lock);
+		bs[i]->flags = flags | B_ASYNC;
+	}
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && bs[j]->blockno == bs[j - 1]->blockno + 1; j++)
+			;
+		iderwn(&bs[i], j - i);
+	}
+	for (i = 0; i < n; i++) {
+		iderwait(bs[i]);
+		releasesleep(&bs[i]->lock);
 	}
 }
 
+// Read or write n slots from slot from on, from or to the log.
+// actually write buffer data into log block
+static void rw_log(int from, int n, int flags) {
+	struct buf *bs[LOGSIZE];
+	int i, slot;
+
+	for (i = 0; i < n; i++) {
+		slot = (from + i) % LOGSIZE;
+		lbuf[slot].blockno = log.start + slot + 1;
+		bs[i] = &lbuf[slot];
+	}
+	lbufrw(bs, n, flags);
+}
+
 // Read the log header from disk into the in-memory log header
 static void read_head(void) {
 	struct buf *buf = bread(log.dev, log.start);
 	struct logheader *lh = (struct logheader *) (buf->data);
 	int i;
-	log.lh.n = lh->n;
-	for (i = 0; i < log.lh.n; i++) {
-		log.lh.block[i] = lh->block[i];
+	log.tail = lh->tail;
+	log.n = lh->n;
+	for (i = 0; i < LOGSIZE; i++) {
+		log.block[i] = lh->block[i];
 	}
 	brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
-// synchronize disk log with memory log
-// let it know which block already write into log disk by write_log()
-static void write_head(void) {
+// Write the in-memory log header to disk, with tail and n moved
+// on by dtail and dn, and then move them on in memory too.
+// Adding to n is the true point at which a transaction commits.
+// The header buf lock keeps logd and ckptd from interleaving here.
+static void write_head(int dtail, int dn) {
 	// read the device's log start block
 	struct buf *buf = bread(log.dev, log.start);
 	// parsing device's log start block as log header block
 	struct logheader *hb = (struct logheader *) (buf->data); // this is header block from device log
 	int i;
-	// write current log.lh.n into header block n
-	hb->n = log.lh.n;
-	for (i = 0; i < log.lh.n; i++) {
-		// write block data pointer array into device log block
-		hb->block[i] = log.lh.block[i]; // remember log block number array into header block number array
+
+	acquire(&log.lock);
+	hb->tail = (log.tail + dtail) % LOGSIZE;
+	hb->n = log.n + dn;
+	for (i = 0; i < LOGSIZE; i++) {
+		// remember the home block number of each slot
+		hb->block[i] = log.block[i];
 	}
+	release(&log.lock);
 	bwrite(buf); // write header block into disk
+
+	acquire(&log.lock);
+	log.tail = hb->tail;
+	log.n = hb->n;
+	wakeup(&log.lh);  // logd may wait for free slots
+	release(&log.lock);
 	brelse(buf); // release header block
 }
 
+// Write the committed blocks home, and free their slots.
+// copy block from log into device data
+static void checkpoint(void) {
+	struct buf *bs[LOGSIZE];
+	int i, j, m, n, tail, slot;
+
+	acquire(&log.lock);
+	tail = log.tail;
+	n = log.n;
+	m = 0;
+	for (i = 0; i < n; i++) {
+		slot = (tail + i) % LOGSIZE;
+		// a later copy of the block in the log supersedes this one
+		for (j = i + 1; j < n; j++)
+			if (log.block[(tail + j) % LOGSIZE] == log.block[slot])
+				break;
+		if (j == n) {
+			lbuf[slot].blockno = log.block[slot];
+			bs[m++] = &lbuf[slot];
+		}
+	}
+	release(&log.lock);
+
+	lbufrw(bs, m, B_DIRTY);  // Now install writes to home locations
+	for (i = 0; i < n; i++) {
+		slot = (tail + i) % LOGSIZE;
+		if (pin[slot]) {
+			bunpin(pin[slot]);
+			pin[slot] = 0;
+		}
+	}
+	write_head(n, -n);  // Erase the transactions from the log
+}
+
 static void recover_from_log(void) {
 	read_head();
-	install_trans(); // if committed, copy from log to disk
-	log.lh.n = 0;
-	write_head(); // clear the log
+	rw_log(log.tail, log.n, 0);
+	checkpoint(); // if committed, copy from log to disk, and clear the log
 }
 
 // called at the start of each FS system call.
 void begin_op(void) {
 	acquire(&log.lock);
 	while (1) {
-		// if current log is during committing, wait for finished
+		// if logd is copying the log out, wait for it
 		if (log.committing) {
 			sleep(&log, &log.lock);
 		} else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE) {
 			// log block space not enough
 			// this op might exhaust log space; wait for commit.
 			sleep(&log, &log.lock);
+#ifndef LOGDATA
+		} else if (log.nfreed[log.fcur] + (log.outstanding + 1) * MAXOPFREE > NFREED) {
+			// no room to record the frees of this op; wait for commit.
+			sleep(&log, &log.lock);
+#endif
 		} else {
 			// the only one exit
 			// counts that number of calls;
@@ -144,9 +269,9 @@ void begin_op(void) {
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// waits for the transaction to commit, unless it is empty.
 void end_op(void) {
-	int do_commit = 0;
+	uint seq;
 
 	acquire(&log.lock);
 
@@ -155,73 +280,110 @@ void end_op(void) {
 	if (log.committing)
 		panic("log.committing");
 
+	// logd cannot have taken this operation's transaction yet
+	seq = log.seq;
+
 	// check if it is the last level of end.
-	if (log.outstanding == 0) {
-		do_commit = 1;
-		log.committing = 1;
-	} else {
-		// wake up other thread waiting for log, like begin_op()
-		// attention: the outstanding--
-		// begin_op() may be waiting for some log space,
-		// and decrementing log.outstanding has decreased
-		// the amount of reserved space.
-		wakeup(&log);
-	}
-	// once release lock, the begin_op() can continue execute
+	if (log.outstanding == 0)
+		wakeup(&log.lh);  // logd
+	// wake up other thread waiting for log, like begin_op()
+	// attention: the outstanding--
+	// begin_op() may be waiting for some log space,
+	// and decrementing log.outstanding has decreased
+	// the amount of reserved space.
+	wakeup(&log);
+
+	// sleep until logd has written the header, more operations
+	// joining the transaction meanwhile; ckptd writes it home later
+	while (log.done < seq && (log.seq != seq || log.lh.n > 0))
+		sleep(&log.done, &log.lock);
 	release(&log.lock);
+}
 
-	// check if it needs to commit
-	if (do_commit) {
-		// call commit w/o holding locks, since not allowed
-		// to sleep with locks.
-		commit();
+// Copy the contents of lh's blocks from cache to the n slots
+// from slot head on. No operation is active, so they do not change.
+static void copy_log(int head, int n) {
+	int tail, slot;
 
-		// once commit total log, can wake up others again
-		// like begin_op() sleep at log.committing
+	for (tail = 0; tail < n; tail++) {
+		slot = (head + tail) % LOGSIZE;
+		struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+		memmove(ldata[slot], from->data, BSIZE);
+		log.block[slot] = log.lh.block[tail];
+		pin[slot] = from;  // stays in the cache: pinned by log_write
+		brelse(from);
+	}
+}
+
+// The commit thread: commits the transaction in lh whenever it
+// has blocks, no operation is in it and there are slots for it,
+// batching the operations of all processes that joined meanwhile.
+static void logd(void) {
+	int head, n, f;
+	uint seq;
+
+	for (;;) {
 		acquire(&log.lock);
+		while (log.lh.n == 0 || log.outstanding > 0 || log.n + log.lh.n > LOGSIZE) {
+			if (log.lh.n > 0 && log.outstanding == 0) {
+				// out of slots: have ckptd free some
+				log.needspace = 1;
+				wakeup(&log.tail);
+			}
+			sleep(&log.lh, &log.lock);
+		}
+		log.committing = 1;
+		// ckptd moves tail and n, but not tail + n
+		head = (log.tail + log.n) % LOGSIZE;
+		n = log.lh.n;
+		release(&log.lock);
+
+		copy_log(head, n);
+
+		// operations start the next transaction in lh while
+		// logd writes this one
+		acquire(&log.lock);
+		log.lh.n = 0;
+		log.ncommit = n;
+		f = log.fcur;
+		log.fcur ^= 1;
+		seq = log.seq++;
 		log.committing = 0;
 		wakeup(&log);
 		release(&log.lock);
-	}
-}
 
-// Copy modified blocks from cache to log.
-// wtfuck function name
-// actually write buffer data into log block
-static void write_log(void) {
-	int tail;
+		// wtfuck name of write_log and log_write
+		rw_log(head, n, B_DIRTY);  // Write modified blocks' data to log slots
+		write_head(0, n);  // Write header to disk -- the real commit
 
-	// write all data from cache into log block
-	for (tail = 0; tail < log.lh.n; tail++) {
-		struct buf *to = bread(log.dev, log.start + tail + 1); // target log block
-		struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-		memmove(to->data, from->data, BSIZE);
-		bwrite(to);  // write the cache data into log block
-		brelse(from);
-		brelse(to);
+		acquire(&log.lock);
+		log.ncommit = 0;
+		log.nfreed[f] = 0;
+		log.done = seq;
+		wakeup(&log.done);
+		if (log.n > LOGSIZE / 2)
+			wakeup(&log.tail);  // ckptd
+		release(&log.lock);
 	}
 }
 
-static void commit() {
-	if (log.lh.n > 0) {
-		// wtfuck name of write_log and log_write
-		// write buffer into log disk
-		write_log();     // Write modified blocks' data from cache to log block
-		// update log header infomation
-		write_head();    // Write header to disk -- the real commit, this is writing the cache buffer into log block
-		// write log disk data into file data
-		install_trans(); // Now install writes to home locations, this is writing the log block into disk block
-		// clear log.lh.n info
-		log.lh.n = 0;    // write log.lh.n = 0 for erase
-		// synchronize to log disk
-		write_head();    // Erase the transaction from the log
+// The checkpoint thread: writes committed blocks home once more
+// than half the log is in use, or logd needs slots.
+static void ckptd(void) {
+	for (;;) {
+		acquire(&log.lock);
+		while (log.n <= LOGSIZE / 2 && !log.needspace)
+			sleep(&log.tail, &log.lock);
+		log.needspace = 0;
+		release(&log.lock);
+		checkpoint();
 	}
 }
 
 // this function is using for write buffer by starting log journey.
 // Caller has modified b->data and is done with the buffer.
-// Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// Record the block number and pin it in the cache.
+// logd will do the disk write.
 //
 //  attention: log_write() replaces bwrite() during log; a typical use is:
 //   bp = bread(...);
@@ -253,11 +415,40 @@ void log_write(struct buf *b) {
 	log.lh.block[i] = b->blockno;
 
 	// check if yes.
-	if (i == log.lh.n)
+	if (i == log.lh.n) {
 		log.lh.n++;
+		// the block is changed but not yet home: keep it cached
+		bpin(b);
+	}
+	release(&log.lock);
+}
 
-	// block is dirty but haven't submit, this is the reason of dirty read, xv6 prevent this.
-	b->flags |= B_DIRTY; // prevent eviction
+#ifndef LOGDATA
+// Record that the transaction in lh frees block blockno.
+void log_free(uint blockno) {
+	acquire(&log.lock);
+	if (log.nfreed[log.fcur] >= NFREED)
+		panic("log_free: too many frees");
+	log.freed[log.fcur][log.nfreed[log.fcur]++] = blockno;
 	release(&log.lock);
 }
+#endif
 
+// May the log still write block blockno home, or has a transaction
+// not yet committed freed it? Then it cannot hold file data that
+// bypasses the log.
+int log_pending(uint blockno) {
+	int i, f, r;
+
+	r = 0;
+	acquire(&log.lock);
+	for (i = 0; i < log.lh.n && !r; i++)
+		r = log.lh.block[i] == blockno;
+	for (i = 0; i < log.n + log.ncommit && !r; i++)
+		r = log.block[(log.tail + i) % LOGSIZE] == blockno;
+	for (f = 0; f < 2; f++)
+		for (i = 0; i < log.nfreed[f] && !r; i++)
+			r = log.freed[f][i] == blockno;
+	release(&log.lock);
+	return r;
+}
@@ -18,6 +18,7 @@ int main(void) {
 	// after boot, the first thing is we need memory
 	// so we need to first construct the page table malloc() and free() mechanism
 	// donate from 0x801126fc to 0x80400000 memory to the page allocate linked list
+	physinit();      // memory size from the BIOS map
 	kinit1(end, P2V(4 * 1024 * 1024));	//phys page allocator
 	// using the former page to setup kernel page table
 	kvmalloc();      // kernel page table
@@ -31,17 +32,20 @@ int main(void) {
 	consoleinit();   // console hardware
 	uartinit();      // serial port
 	pinit();         // process table
+	shminit();       // shared memory segments
 
 	// initial IDT
 	tvinit();        // trap vectors init
 	binit();         // buffer cache
 	fileinit();      // file table
 	ideinit();       // disk
+	swapinit();      // swap area
 
 	// other process boots
 	startothers();   // start other processors
-	kinit2(P2V(4 * 1024 * 1024), P2V(PHYSTOP)); // must come after startothers()
+	kinit2(P2V(4 * 1024 * 1024), P2V(phystop)); // must come after startothers()
 	userinit(); // like a fork to initial first user process, and set it as runnable
+	kthread("kzerod", kzerod); // refills the zeroed page pool when idle
 	mpmain(); // go into CPU scheduler process and finish this processor's setup, to run first user process
 }
 
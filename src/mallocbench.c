@@ -0,0 +1,107 @@
+// Benchmark malloc() and free(): throughput of a random mix of
+// allocations, and fragmentation, as heap grown per live byte
+// after a workload that frees every other block.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NSLOT  1024
+#define NOPS   200000
+
+static char *slot[NSLOT];
+static uint slotsize[NSLOT];
+static uint seed = 1;
+
+static uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7FFF;
+}
+
+// Mostly small sizes, some medium ones, rarely a large one.
+static uint
+randsize(void)
+{
+  uint r;
+
+  r = rand() % 100;
+  if(r < 90)
+    return 1 + rand() % 256;
+  if(r < 99)
+    return 257 + rand() % 8192;
+  return 65536 + rand() % 262144;
+}
+
+static void
+throughput(void)
+{
+  int i, j, start, ticks;
+
+  start = uptime();
+  for(i = 0; i < NOPS; i++){
+    j = rand() % NSLOT;
+    if(slot[j]){
+      free(slot[j]);
+      slot[j] = 0;
+    } else if((slot[j] = malloc(randsize())) == 0){
+      printf(2, "mallocbench: out of memory\n");
+      exit();
+    } else
+      slot[j][0] = 1;
+  }
+  ticks = uptime() - start;
+  for(j = 0; j < NSLOT; j++){
+    free(slot[j]);
+    slot[j] = 0;
+  }
+  printf(1, "%d malloc/free in %d ticks", NOPS, ticks);
+  if(ticks > 0)
+    printf(1, ", %d per tick", NOPS / ticks);
+  printf(1, "\n");
+}
+
+static void
+fragmentation(void)
+{
+  uint live, heap, j;
+  char *brk;
+
+  brk = sbrk(0);
+  live = 0;
+  for(j = 0; j < NSLOT; j++){
+    slotsize[j] = 1 + rand() % 512;
+    if((slot[j] = malloc(slotsize[j])) == 0){
+      printf(2, "mallocbench: out of memory\n");
+      exit();
+    }
+    live += slotsize[j];
+  }
+  // free every other block, then ask for bigger ones
+  for(j = 0; j < NSLOT; j += 2){
+    free(slot[j]);
+    live -= slotsize[j];
+    slotsize[j] = 513 + rand() % 1024;
+    if((slot[j] = malloc(slotsize[j])) == 0){
+      printf(2, "mallocbench: out of memory\n");
+      exit();
+    }
+    live += slotsize[j];
+  }
+  heap = sbrk(0) - brk;
+  printf(1, "live %d bytes, heap grew %d bytes", live, heap);
+  if(live > 0)
+    printf(1, ", overhead %d%%", (heap - live) * 100 / live);
+  printf(1, "\n");
+  for(j = 0; j < NSLOT; j++)
+    free(slot[j]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  throughput();
+  fragmentation();
+  exit();
+}
@@ -12,11 +12,13 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
 extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
 
 static int disksize;
 static uchar *memdisk;
+static struct iostat iostat;
 
 void
 ideinit(void)
@@ -52,9 +54,52 @@ iderw(struct buf *b)
   p = memdisk + b->blockno*BSIZE;
 
   if(b->flags & B_DIRTY){
+    iostat.writes++;
+    iostat.wblocks[blocktype(b->dev, b->blockno)]++;
     b->flags &= ~B_DIRTY;
     memmove(p, b->data, BSIZE);
-  } else
+  } else {
+    iostat.reads++;
+    iostat.rblocks[blocktype(b->dev, b->blockno)]++;
     memmove(b->data, p, BSIZE);
+  }
   b->flags |= B_VALID;
+  if(b->flags & B_ASYNC){
+    b->flags &= ~B_ASYNC;
+    if(b->iodone){
+      void (*iodone)(struct buf*) = b->iodone;
+      b->iodone = 0;
+      iodone(b);
+    }
+  }
+}
+
+void
+iderwn(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    iderw(bs[i]);
+}
+
+// Requests complete in iderw().
+void
+iderwait(struct buf *b)
+{
+}
+
+// Fill in the disk counters of st. There is no waiting.
+void
+idestat(struct iostat *st)
+{
+  int i;
+
+  st->reads = iostat.reads;
+  st->writes = iostat.writes;
+  st->waitticks = 0;
+  for(i = 0; i < NIOTYPE; i++){
+    st->rblocks[i] = iostat.rblocks[i];
+    st->wblocks[i] = iostat.wblocks[i];
+  }
 }
@@ -1,12 +1,16 @@
 // Memory layout
 
 #define EXTMEM  0x100000            // Start of extended memory
-#define PHYSTOP 0xE000000           // Top physical memory
+#define PHYSTOP 0xE000000           // Top physical memory if the BIOS has no map
+#define MAXPHYS 0x7E000000          // Most physical memory the kernel can map
+#define E820MAP 0x8000              // BIOS memory map, left by bootasm.S
 #define DEVSPACE 0xFE000000         // Other devices are at high addresses
 
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000         // First kernel virtual address
 #define KERNLINK (KERNBASE+EXTMEM)  // Address where kernel is linked
+#define MMAPTOP  0x7F000000         // Mappings are placed down from here
+#define USTACKTOP 0x7FFFF000        // Top of the user stack, above the mappings
 
 #define V2P(a) (((uint) (a)) - KERNBASE)
 #define P2V(a) (((void *) (a)) + KERNBASE)
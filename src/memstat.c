@@ -0,0 +1,34 @@
+// Report physical memory fragmentation: the number of free
+// blocks of each buddy order, the free memory they add up to,
+// and how much of it is not in the largest block size.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+int
+main(int argc, char *argv[])
+{
+  int nfree[KMAXORDER+1];
+  uint pages, big;
+  int i;
+
+  if(kmemstat(nfree) < 0){
+    printf(2, "memstat: kmemstat failed\n");
+    exit();
+  }
+
+  pages = 0;
+  printf(1, "order  pages  free blocks\n");
+  for(i = 0; i <= KMAXORDER; i++){
+    printf(1, "%d\t%d\t%d\n", i, 1 << i, nfree[i]);
+    pages += nfree[i] << i;
+  }
+  big = nfree[KMAXORDER] << KMAXORDER;
+  printf(1, "free: %d pages (%d KB)\n", pages, pages * 4);
+  if(pages > 0)
+    printf(1, "fragmented: %d%% of free pages are outside %d-page blocks\n",
+           (pages - big) * 100 / pages, 1 << KMAXORDER);
+  exit();
+}
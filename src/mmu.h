@@ -38,6 +38,7 @@
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
 
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
@@ -123,6 +124,7 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define PDSIZE          (PGSIZE*NPTENTRIES) // bytes mapped by a 4 MB (PTE_PS) page
 
 #define PGSHIFT         12      // log2(PGSIZE)
 #define PTXSHIFT        12      // offset of PTX in a linear address
@@ -140,7 +142,15 @@ struct segdesc {
 #define PTE_A           0x020   // Accessed
 #define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_G           0x100   // Global (kept across %cr3 reloads)
 #define PTE_MBZ         0x180   // Bits must be zero
+#define PTE_SWAP        0x200   // Software: not present, in swap slot PTE_ADDR>>PGSHIFT
+#define PTE_SHARED      0x400   // Software: page of a shared mapping
+
+// Page fault error code bits (tf->err of a T_PGFLT)
+#define FEC_PR          0x001   // Page was present: a protection violation
+#define FEC_WR          0x002   // Fault was a write
+#define FEC_U           0x004   // Fault was in user mode
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
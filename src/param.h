@@ -9,6 +9,18 @@
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*3)  // initial size of disk block cache
+#define BCACHEPCT    10  // most of RAM, in percent, the block cache grows to
+#define RAMAX        32  // most blocks read ahead of a sequential reader
+#define NWDATA       32  // file blocks written home per transaction, past the log
+#define FSSIZE       2000  // size of file system in blocks
+#define KMAXORDER    10  // largest kalloc_order() block: 2^10 pages (4 MB)
+#define NVMA         16  // mappings (e.g. shared memory) per process
+#define NSHM         16  // shared memory segments per system
+#define SHMMAXPG    256  // max pages in a shared memory segment (1 MB)
+#define NZPOOL       64  // pre-zeroed pages kept by kzerod
+#define SWAPDEV       0  // disk holding the swap area: the boot disk
+#define SWAPSTART  2048  // first swap block on SWAPDEV, past the kernel
+#define NSWAP      2048  // swap slots, a page each (8 MB)
+#define USTACKMAX  (1024*1024)  // most bytes the user stack grows to
 
@@ -0,0 +1,64 @@
+// Benchmark context switches between threads: two threads of
+// one process hand a token back and forth, each sleeping until
+// the other passes it. The threads share a page directory, so a
+// switch between them does not reload %cr3 or flush the TLB.
+// Reports ticks for NROUND round trips (two switches each).
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "lockFunc.h"
+
+#define NROUND  2000
+
+static struct thread_mutex ml;
+static struct thread_cond cv;
+static volatile int turn;
+
+// Wait until turn is me, then pass it to the other thread.
+static void
+pass(int me)
+{
+  thread_mutex_lock(&ml);
+  while(turn != me)
+    mysleep((void*)&cv.cond, (void*)&ml);
+  turn = !me;
+  thread_mutex_unlock(&ml);
+  mywakeup((void*)&cv.cond);
+}
+
+static void
+pong(void *arg)
+{
+  int i;
+
+  for(i = 0; i < NROUND; i++)
+    pass(1);
+  thread_exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  void *stack;
+  int i, start, ticks;
+
+  thread_mutex_init(&ml);
+  turn = 0;
+  if((stack = malloc(4096)) == 0){
+    printf(2, "pingpong: malloc failed\n");
+    exit();
+  }
+  start = uptime();
+  if(thread_create(pong, 0, stack) < 0){
+    printf(2, "pingpong: thread_create failed\n");
+    exit();
+  }
+  for(i = 0; i < NROUND; i++)
+    pass(0);
+  thread_join();
+  ticks = uptime() - start;
+  printf(1, "round trips\tticks\n");
+  printf(1, "%d\t\t%d\n", NROUND, ticks);
+  exit();
+}
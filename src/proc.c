@@ -83,6 +83,8 @@ allocproc(void) {
 
 	found: p->state = EMBRYO;
 	p->pid = nextpid++;
+	p->isThread = 0;
+	p->pgdir = 0;
 
 	release(&ptable.lock);
 
@@ -170,14 +172,129 @@ void userinit(void) {
 	release(&ptable.lock);
 }
 
+// Start a kernel thread running fn(), which must never return.
+// It has no user memory: its pgdir only maps the kernel.
+void kthread(char *name, void (*fn)(void)) {
+	struct proc *p;
+
+	if ((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+		panic("kthread");
+	// forkret() returns to fn instead of trapret
+	((uint*) p->tf)[-1] = (uint) fn;
+	safestrcpy(p->name, name, sizeof(p->name));
+
+	acquire(&ptable.lock);
+	p->state = RUNNABLE;
+	release(&ptable.lock);
+}
+
+//PAGEBREAK!
+// Page eviction for swap.c. The pages of a process may be evicted
+// while no CPU uses its page table: while it and any threads
+// sharing the pgdir are RUNNABLE or SLEEPING. With ptable.lock
+// held, that also means no CPU has the pgdir in %cr3 (see
+// scheduler), so no TLB holds its entries. A process sleeping in
+// a system call keeps the user memory the call uses, [pinlo,
+// pinhi), which argptr() and friends record.
+
+// Clock hand: the next page swapvictim() looks at.
+static struct proc *hand = ptable.proc;
+static uint handva;
+
+static int evictable(struct proc *p) {
+	struct proc *q;
+
+	if ((p->state != RUNNABLE && p->state != SLEEPING) || p->pgdir == 0)
+		return 0;
+	for (q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+		if (q->pgdir == p->pgdir && q->state == RUNNING)
+			return 0;
+	return 1;
+}
+
+static int pinned(pde_t *pgdir, uint va) {
+	struct proc *q;
+
+	for (q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+		if (q->pgdir == pgdir && q->state != UNUSED
+				&& va >= PGROUNDDOWN(q->pinlo) && va < q->pinhi)
+			return 1;
+	return 0;
+}
+
+// Advance the clock hand over p's pages from handva up, clearing
+// accessed bits, to the first page whose accessed bit was clear
+// already. Make its PTE refer to swap slot slot and return it.
+static char* sweep(struct proc *p, uint slot) {
+	pte_t *pte;
+	char *page;
+
+	for (; handva < p->sz; handva += PGSIZE) {
+		if ((p->pgdir[PDX(handva)] & (PTE_P | PTE_PS)) != PTE_P) {
+			handva = PGADDR(PDX(handva) + 1, 0, 0) - PGSIZE;
+			continue;
+		}
+		pte = walkpgdir(p->pgdir, (void*) handva, 0);
+		if ((*pte & (PTE_P | PTE_U)) != (PTE_P | PTE_U)
+				|| pinned(p->pgdir, handva))
+			continue;
+		if (*pte & PTE_A) {
+			*pte &= ~PTE_A;  // second chance
+			continue;
+		}
+		page = P2V(PTE_ADDR(*pte));
+		*pte = (slot << PGSHIFT) | PTE_SWAP
+				| (PTE_FLAGS(*pte) & ~(PTE_P | PTE_A | PTE_D));
+		vmcount(p->pgdir, -1, 0, 0);
+		handva += PGSIZE;
+		return page;
+	}
+	return 0;
+}
+
+// Choose a cold user page with the clock algorithm and unmap
+// it, leaving swap slot slot in its PTE. Returns the page, for
+// the caller to write to the slot and free; 0 if there is none.
+char* swapvictim(uint slot) {
+	char *page;
+	int n;
+
+	page = 0;
+	acquire(&ptable.lock);
+	// at most two sweeps: the first may only clear accessed bits
+	for (n = 0; n <= 2 * NPROC && page == 0; n++) {
+		if (evictable(hand))
+			page = sweep(hand, slot);
+		if (page == 0) {
+			if (++hand == &ptable.proc[NPROC])
+				hand = ptable.proc;
+			handva = 0;
+		}
+	}
+	release(&ptable.lock);
+	return page;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int growproc(int n) {
 	uint sz;
 	struct proc *curproc = myproc();
+	struct vmacct *a;
 
 	sz = curproc->sz;
-	if (n > 0) {
+	// the heap may not grow into the mappings above it
+	if (n > 0 && sz + n > vmabase(curproc))
+		return -1;
+	// nor past the resident page limit
+	a = vmacct(curproc->pgdir);
+	if (n > 0 && a->rsslimit
+			&& a->rss + (PGROUNDUP(sz + n) - PGROUNDUP(sz)) / PGSIZE > a->rsslimit)
+		return -1;
+	if (n > 0 && curproc->bigheap) {
+		if ((sz = allocuvm_pse(curproc->pgdir, sz, sz + n)) == 0)
+			return -1;
+	} else if (n > 0) {
 		if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
 			return -1;
 	} else if (n < 0) {
@@ -185,7 +302,9 @@ int growproc(int n) {
 			return -1;
 	}
 	curproc->sz = sz;
-	switchuvm(curproc);
+	// same pgdir, so switchuvm() would not reload %cr3; flush the
+	// user TLB entries of any pages deallocuvm() just unmapped
+	lcr3(V2P(curproc->pgdir));
 	return 0;
 }
 
@@ -194,6 +313,7 @@ int growproc(int n) {
 // Caller must set state of returned proc to RUNNABLE.
 int fork(void) {
 	int i, pid;
+	uint sz;
 	struct proc *np;
 	struct proc *curproc = myproc();
 
@@ -203,13 +323,25 @@ int fork(void) {
 	}
 
 	// Copy process state from proc.
-	if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0) {
+	sz = curproc->sz;
+	if ((np->pgdir = copyuvm(curproc->pgdir, &sz)) == 0) {
+		kfree(np->kstack);
+		np->kstack = 0;
+		np->state = UNUSED;
+		return -1;
+	}
+	np->sz = sz;  // what copyuvm() copied
+	np->bigheap = curproc->bigheap;
+	// the child maps the same pages as the parent above the heap
+	if (vmadup(np, curproc) < 0) {
+		vmaclear(np);
+		freevm(np->pgdir);
+		np->pgdir = 0;
 		kfree(np->kstack);
 		np->kstack = 0;
 		np->state = UNUSED;
 		return -1;
 	}
-	np->sz = curproc->sz;
 	np->parent = curproc;
 	*np->tf = *curproc->tf;
 
@@ -246,6 +378,9 @@ void exit(void) {
 	if (curproc == initproc)
 		panic("init exiting");
 
+	// Drop the mappings, if no thread still runs in them.
+	vmput(curproc);
+
 	// Close all open files.
 	for (fd = 0; fd < NOFILE; fd++) {
 		if (curproc->ofile[fd]) {
@@ -279,6 +414,31 @@ void exit(void) {
 	panic("zombie exit");
 }
 
+// Free pgdir, unless a process still runs in it: a thread may
+// outlive its creator, or the other way around. The caller has
+// let go of it, and holds ptable.lock.
+static void pgdirput(pde_t *pgdir) {
+	struct proc *p;
+
+	for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+		if (p->pgdir == pgdir && p->state != UNUSED)
+			return;
+	freevm(pgdir);
+}
+
+// Switch p, the current process, to pgdir (exec), and let
+// go of the old one.
+void setpgdir(struct proc *p, pde_t *pgdir) {
+	pde_t *old;
+
+	acquire(&ptable.lock);
+	old = p->pgdir;
+	p->pgdir = pgdir;
+	switchuvm(p);
+	pgdirput(old);
+	release(&ptable.lock);
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int wait(void) {
@@ -299,12 +459,13 @@ int wait(void) {
 				pid = p->pid;
 				kfree(p->kstack);
 				p->kstack = 0;
-				freevm(p->pgdir);
 				p->pid = 0;
 				p->parent = 0;
 				p->name[0] = 0;
 				p->killed = 0;
 				p->state = UNUSED;
+				pgdirput(p->pgdir);
+				p->pgdir = 0;
 				release(&ptable.lock);
 				return pid;
 			}
@@ -332,8 +493,11 @@ int wait(void) {
 //      via swtch back to the scheduler.
 void scheduler(void) {
 	struct proc *p;
+	void *chan;
+	int ran;
 	struct cpu *c = mycpu();
 	c->proc = 0; // initial cpu process
+	c->pgdir = 0; // kvmalloc() or mpenter() loaded kpgdir
 
 	for (;;) {
 		// Enable interrupts on this processor.
@@ -341,9 +505,11 @@ void scheduler(void) {
 
 		// Loop over process table looking for process to run.
 		acquire(&ptable.lock);
+		ran = 0;
 		for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
 			if (p->state != RUNNABLE)
 				continue;
+			ran = 1;
 
 			// Switch to chosen process.  It is the process's job
 			// to release ptable.lock and then reacquire it
@@ -357,13 +523,23 @@ void scheduler(void) {
 			// Only when new process yield or finish, the instruction strea  ssaaassaaaassssssssaaam will go to the following
 			swtch(&(c->scheduler), p->context);
 
-			// TODO: ?? why need to switch kvm again?
-			switchkvm();
+			// Keep p's pgdir loaded: if the next process shares it
+			// (a thread), switchuvm() can skip the %cr3 reload.
 
 			// Process is done running for now.
 			// It should have changed its p->state before coming back.
 			c->proc = 0;
 		}
+
+		// Once ptable.lock is released, exec() or wait() may free the
+		// pgdir this CPU still has loaded, so go back to kpgdir first.
+		if (c->pgdir) {
+			switchkvm();
+			c->pgdir = 0;
+		}
+		// nothing to run: a good time to zero free pages
+		if (!ran && (chan = kzerowanted()) != 0)
+			wakeup1(chan);
 		release(&ptable.lock);
 
 	}
@@ -539,6 +715,7 @@ void procdump(void) {
 		}
 		cprintf("\n");
 	}
+	bcachedump();
 }
 
 #define PGSIZE 4096
@@ -564,46 +741,41 @@ int myprint(char * buffer, uint addr, uint n) {
 }
 
 /**
- * copy buffer from stack
+ * copy buffersize bytes of user memory at addr in pgdir to
+ * buffer + offset. Pages that are not resident (not touched yet,
+ * swapped out, or not mapped at all) read as zeros.
  */
 int mycopybuffer(pde_t *pgdir, char * addr, char * buffer, uint offset,
 		uint buffersize) {
-	int guardFlag = 0;
-	uint i, pa, n;
-	pte_t * pte;
-	for (i = 0; i < buffersize; i += PGSIZE) {
-		if ((pte = walkpgdir(pgdir, addr + i, 0)) == 0) {
-			panic("mycopybuffer: fail to walkpgdir");
-		}
-		pa = PTE_ADDR(*pte);
-		if (buffersize - i < PGSIZE) {
-			n = buffersize - i;
-		} else {
-			n = PGSIZE;
-		}
-		if (guardFlag == 0 && (*pte & PTE_U) == 0) {
-			guardFlag++;
-			memmove((char*) buffer + buffersize, &i, sizeof(uint));
+	uint i, va, n;
+	char *ka;
+	for (i = 0; i < buffersize; i += n) {
+		va = (uint) addr + i;
+		n = min(PGSIZE - va % PGSIZE, buffersize - i);
+		// uva2ka() reads 4 MB heap pages from their PDE
+		if ((ka = uva2ka(pgdir, (char*) PGROUNDDOWN(va))) == 0) {
+			memset(buffer + offset + i, 0, n);
+			continue;
 		}
-//		if(guardFlag == 1 && (*pte & PTE_U) != 0){
-//			guardFlag++;
-//			memmove((char*) buffer + buffersize - sizeof(uint), &i, sizeof(uint));
-//		}
-		if (mywritebuffer(buffer, P2V(pa), i, n) != n) {
+		if (mywritebuffer(buffer, ka + va % PGSIZE, offset + i, n) != n) {
 			return -1;
 		}
-		//myprint(buffer + i, (uint)(*addr + i), n);
 	}
 	return 0;
 }
 
 /**
- * dump memory for gdb
+ * dump memory for gdb. ptable.lock keeps the target from being
+ * reaped, freeing its pgdir, while this copies; buffer is pinned
+ * (argoutptr), so writing to it does not fault.
  */
 int dump(int pid, char * addr, char * buffer, uint buffersize) {
 	struct proc *p;
+	int r;
+
+	acquire(&ptable.lock);
 	for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-		if (p->pid == pid) {
+		if (p->pid == pid && pid != 0) {
 			//	uint i = 0x0;
 			//	for(i = 0; i < buffersize; i+=PGSIZE){
 			//		pte_t * pte;
@@ -613,18 +785,60 @@ int dump(int pid, char * addr, char * buffer, uint buffersize) {
 			break;
 		}
 	}
-	if (p->pid != pid) {
-		panic("dump: fail to get pid");
-	}
-	if (mycopybuffer(p->pgdir, addr, buffer, 0x00, buffersize) != 0) {
-		panic("dump: fail to copy");
+	// an exited process may have left its memory already
+	if (p == &ptable.proc[NPROC] || p->state == UNUSED || p->state == EMBRYO
+			|| p->state == ZOMBIE || p->pgdir == 0) {
+		release(&ptable.lock);
+		return -1;
 	}
+	r = mycopybuffer(p->pgdir, addr, buffer, 0x00, buffersize);
+	release(&ptable.lock);
+	if (r != 0)
+		return -1;
 
 	return 0;
 }
 
+// Print the memory use of each process: its size, and the
+// resident, page table and shared pages of its address space
+// (threads share their creator's), and how much of its kernel
+// stack is in use, when that is known (not running elsewhere).
 int ps() {
-	panic("ps exec");
+	static char *states[] = { [UNUSED] "unused", [EMBRYO] "embryo", [SLEEPING
+			] "sleep ", [RUNNABLE] "runble", [RUNNING] "run   ", [ZOMBIE
+			] "zombie" };
+	struct proc *p;
+	struct vmacct *a;
+	char *state;
+	uint kstack;
+
+	cprintf("pid\tstate\tname\tsz\trss\tpt\tshared\tlimit\tkstack\n");
+	acquire(&ptable.lock);
+	for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+		if (p->state == UNUSED)
+			continue;
+		if (p->state >= 0 && p->state < NELEM(states) && states[p->state])
+			state = states[p->state];
+		else
+			state = "???";
+		cprintf("%d\t%s\t%s\t%d", p->pid, state, p->name, p->sz);
+		if ((a = vmacct(p->pgdir)) != 0)
+			cprintf("\t%d\t%d\t%d\t%d", a->rss, a->ptpages, a->shared,
+					a->rsslimit);
+		else
+			cprintf("\t-\t-\t-\t-");
+		if (p == myproc())
+			kstack = (uint) p->kstack + KSTACKSIZE - (uint) &kstack;
+		else if (p->state == SLEEPING || p->state == RUNNABLE)
+			kstack = (uint) p->kstack + KSTACKSIZE - (uint) p->context;
+		else
+			kstack = 0;
+		if (kstack)
+			cprintf("\t%d\n", kstack);
+		else
+			cprintf("\t-\n");
+	}
+	release(&ptable.lock);
 	return 0;
 }
 
@@ -644,6 +858,9 @@ int thread_create(void (*fcn)(void *), void * arg, void * stack) {
 
 	np->pgdir = curproc->pgdir;
 	np->sz = curproc->sz;
+	np->bigheap = curproc->bigheap;
+	// the thread shares its creator's pgdir, and so its mappings
+	vmhold(np->pgdir);
 	np->parent = curproc;
 	*np->tf = *curproc->tf;
 
@@ -702,12 +919,13 @@ int thread_join(void) {
 				pid = p->pid;
 				//kfree(p->kstack);
 				p->kstack = 0;
-				//freevm(p->pgdir);
 				p->pid = 0;
 				p->parent = 0;
 				p->name[0] = 0;
 				p->killed = 0;
 				p->state = UNUSED;
+				pgdirput(p->pgdir);
+				p->pgdir = 0;
 				release(&ptable.lock);
 				return pid;
 			}
@@ -732,6 +950,9 @@ int thread_exit() {
 	if (curproc == initproc)
 		panic("init exiting");
 
+	// Drop the mappings, if no other thread still runs in them.
+	vmput(curproc);
+
 	// Close all open files.
 	for (fd = 0; fd < NOFILE; fd++) {
 		if (curproc->ofile[fd]) {
@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  pde_t *pgdir;                // Process page table in %cr3, or 0 for kpgdir
 };
 
 extern struct cpu cpus[NCPU];
@@ -34,6 +35,44 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A mapping of part of the user address space other than the
+// process image [0, sz): an attached shared memory segment, or an
+// mmap() of a file or of anonymous memory. Mappings are placed
+// top-down from MMAPTOP; the heap may not grow into them.
+// File and anonymous pages are filled in on first touch, and so
+// are those of the user stack, which exec() reserves up to
+// USTACKMAX below USTACKTOP, above the other mappings.
+enum vmatype { VMA_NONE, VMA_SHM, VMA_FILE, VMA_ANON, VMA_STACK };
+
+struct vma {
+  enum vmatype type;
+  uint start;                  // First address, page aligned
+  uint end;                    // One past the last address, page aligned
+  int prot;                    // PROT_READ, PROT_WRITE
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  int shmid;                   // VMA_SHM: the segment
+  struct file *file;           // VMA_FILE: the file, from offset off
+  uint off;                    // VMA_FILE: file offset of start
+};
+
+// Memory use of an address space, in pages (see vmacct).
+struct vmacct {
+  uint rss;                    // Resident user pages, 4 MB pages counting 1024
+  uint ptpages;                // Page table pages, and the pgdir itself
+  uint shared;                 // Resident pages of shared mappings
+  uint rsslimit;               // Most resident pages the heap may grow to, or 0
+};
+
+// What vm.c keeps for each pgdir, from setupkvm() to freevm()
+// (see vmspace). Threads share their creator's pgdir, and so
+// its mappings and accounting.
+struct vmspace {
+  pde_t *pgdir;                // 0 if the slot is free
+  int users;                   // Processes in it that have not exited
+  struct vma vma[NVMA];        // Mappings above the heap
+  struct vmacct acct;
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -50,6 +89,8 @@ struct proc {
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   int isThread;
+  int bigheap;                 // If non-zero, grow heap with 4 MB pages
+  uint pinlo, pinhi;           // User memory the current syscall uses
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -83,7 +83,7 @@ int myps() {
 //			return -1;
 //		}
 //	}
-	return 0;
+	return ps();
 }
 
 int main(int argc, char *argv[]) {
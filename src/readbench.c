@@ -0,0 +1,71 @@
+// Benchmark parallel reads through the buffer cache: 1, 2, 4
+// and 8 processes each read the same cached file over and over.
+// With little contention in the cache, the time for the same
+// work per process stays flat as processes are added (up to the
+// number of CPUs).
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define FILE    "readbench.tmp"
+#define FILESZ  (12*512)  // direct blocks only: all of it fits in NBUF
+#define NPASS   200
+
+static char buf[512];
+
+static void
+reader(void)
+{
+  int fd, i;
+
+  for(i = 0; i < NPASS; i++){
+    if((fd = open(FILE, O_RDONLY)) < 0){
+      printf(2, "readbench: open %s failed\n", FILE);
+      exit();
+    }
+    while(read(fd, buf, sizeof(buf)) > 0)
+      ;
+    close(fd);
+  }
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, pid, start, ticks;
+
+  if((fd = open(FILE, O_CREATE | O_RDWR)) < 0){
+    printf(2, "readbench: create %s failed\n", FILE);
+    exit();
+  }
+  memset(buf, 'r', sizeof(buf));
+  for(i = 0; i < FILESZ; i += sizeof(buf))
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(2, "readbench: write failed\n");
+      exit();
+    }
+  close(fd);
+
+  printf(1, "procs\tticks\tKB read\n");
+  for(n = 1; n <= 8; n *= 2){
+    start = uptime();
+    for(i = 0; i < n; i++){
+      pid = fork();
+      if(pid < 0){
+        printf(2, "readbench: fork failed\n");
+        exit();
+      }
+      if(pid == 0)
+        reader();
+    }
+    for(i = 0; i < n; i++)
+      wait();
+    ticks = uptime() - start;
+    printf(1, "%d\t%d\t%d\n", n, ticks, n * NPASS * (FILESZ / 1024));
+  }
+  unlink(FILE);
+  exit();
+}
@@ -0,0 +1,144 @@
+// Shared memory segments.
+//
+// shmget() finds or creates a segment of zeroed pages by key,
+// shmat() maps all of its pages into the calling process, and
+// shmdt() unmaps them again. Every page table that maps a page
+// holds a reference to it (see kincref), so freevm() of one
+// leaves the page to the others. A segment is freed when its
+// last attachment goes away through shmdt(), exit() or exec();
+// until it is first attached, a new segment stays around.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "fcntl.h"
+#include "spinlock.h"
+
+struct shmseg {
+	int key;                  // shmget() key, 0 for a private segment
+	int npages;               // 0 if this slot is free
+	int nattach;              // vmas mapping the segment
+	char *pages[SHMMAXPG];
+};
+
+struct {
+	struct spinlock lock;
+	struct shmseg seg[NSHM];
+} shmtable;
+
+void shminit(void) {
+	initlock(&shmtable.lock, "shmtable");
+}
+
+// Return the id of the segment with the given key, or of a new
+// one of size bytes if there is none or key is 0.
+int shmget(int key, int size) {
+	struct shmseg *s, *ns;
+	int i, n;
+
+	if (size <= 0 || size > SHMMAXPG * PGSIZE)
+		return -1;
+	n = PGROUNDUP(size) / PGSIZE;
+
+	acquire(&shmtable.lock);
+	ns = 0;
+	for (s = shmtable.seg; s < &shmtable.seg[NSHM]; s++) {
+		if (s->npages == 0) {
+			if (ns == 0)
+				ns = s;
+		} else if (key != 0 && s->key == key) {
+			i = s->npages >= n ? s - shmtable.seg : -1;
+			release(&shmtable.lock);
+			return i;
+		}
+	}
+	if (ns == 0) {
+		release(&shmtable.lock);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if ((ns->pages[i] = kalloc_zeroed()) == 0) {
+			while (--i >= 0)
+				kfree(ns->pages[i]);
+			release(&shmtable.lock);
+			return -1;
+		}
+	}
+	ns->key = key;
+	ns->npages = n;
+	ns->nattach = 0;
+	release(&shmtable.lock);
+	return ns - shmtable.seg;
+}
+
+// Map segment id into the current process.
+// Returns the address it is mapped at, or -1.
+int shmat(int id) {
+	struct proc *curproc = myproc();
+	struct shmseg *s;
+	struct vma *v;
+
+	if (id < 0 || id >= NSHM)
+		return -1;
+	s = &shmtable.seg[id];
+
+	acquire(&shmtable.lock);
+	if (s->npages == 0
+			|| (v = vmaalloc(curproc, s->npages * PGSIZE, VMA_SHM)) == 0) {
+		release(&shmtable.lock);
+		return -1;
+	}
+	if (mapshared(curproc->pgdir, v->start, s->pages, s->npages,
+			PTE_W | PTE_U) < 0) {
+		v->type = VMA_NONE;
+		release(&shmtable.lock);
+		return -1;
+	}
+	v->prot = PROT_READ | PROT_WRITE;
+	v->flags = MAP_SHARED;
+	v->shmid = id;
+	s->nattach++;
+	release(&shmtable.lock);
+	return v->start;
+}
+
+// Unmap the segment attached at addr from the current process.
+int shmdt(uint addr) {
+	struct proc *curproc = myproc();
+	struct vma vm;
+
+	if (vmadetach(curproc, addr, 0, 1, &vm) < 0)
+		return -1;
+	deallocuvm(curproc->pgdir, vm.end, vm.start);
+	lcr3(V2P(curproc->pgdir));  // flush the unmapped pages from the TLB
+	shmrelease(&vm);
+	return 0;
+}
+
+// A copy of vma v now maps its segment too (fork).
+void shmdup(struct vma *v) {
+	acquire(&shmtable.lock);
+	shmtable.seg[v->shmid].nattach++;
+	release(&shmtable.lock);
+}
+
+// Vma v no longer maps its segment. The pages it mapped
+// must be unmapped, or about to be freed with its pgdir.
+void shmrelease(struct vma *v) {
+	struct shmseg *s;
+	int i;
+
+	acquire(&shmtable.lock);
+	s = &shmtable.seg[v->shmid];
+	if (--s->nattach == 0) {
+		// drop the segment's own reference to its pages
+		for (i = 0; i < s->npages; i++)
+			kfree(s->pages[i]);
+		s->npages = 0;
+	}
+	release(&shmtable.lock);
+}
@@ -0,0 +1,128 @@
+// Swap space for user pages.
+//
+// The swap area is NSWAP page-sized slots starting at block
+// SWAPSTART of disk SWAPDEV, past the kernel on the boot disk.
+// When memory runs out, swapout() picks a cold user page with the
+// clock algorithm (see swapvictim in proc.c), writes it to a free
+// slot and frees it. Its PTE keeps PTE_SWAP and the slot number
+// instead of PTE_P and the physical address, and the next fault
+// on it reads it back in (see pagefault in vm.c).
+//
+// Swap I/O goes straight to the disk through private bufs, whose
+// data points into the page itself, not through the buffer cache,
+// and one page at a time, in one disk request: swapio is held
+// across each transfer.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+// swapmap.state[]
+#define SWAP_FREE     0
+#define SWAP_USED     1   // holds a page
+#define SWAP_WRITING  2   // page being written out
+#define SWAP_DROPPED  3   // being written out, but no longer needed
+
+struct {
+	struct spinlock lock;
+	uchar state[NSWAP];
+} swapmap;
+
+struct sleeplock swapio;   // serializes swap I/O, and buf
+static struct buf buf[PGSIZE / BSIZE];
+
+void swapinit(void) {
+	int i;
+
+	initlock(&swapmap.lock, "swapmap");
+	initsleeplock(&swapio, "swapio");
+	for (i = 0; i < NELEM(buf); i++)
+		initsleeplock(&buf[i].lock, "swapbuf");
+}
+
+// Read or write the page at kernel address page from or to
+// swap slot slot. Caller must hold swapio.
+static void swaprw(char *page, uint slot, int write) {
+	struct buf *bs[PGSIZE / BSIZE];
+	int i;
+
+	for (i = 0; i < NELEM(buf); i++) {
+		acquiresleep(&buf[i].lock);
+		buf[i].dev = SWAPDEV;
+		buf[i].blockno = SWAPSTART + slot * (PGSIZE / BSIZE) + i;
+		buf[i].data = (uchar*) page + i * BSIZE;
+		buf[i].flags = write ? B_DIRTY : 0;
+		bs[i] = &buf[i];
+	}
+	// the page's blocks are consecutive: one request
+	iderwn(bs, NELEM(buf));
+	for (i = 0; i < NELEM(buf); i++)
+		releasesleep(&buf[i].lock);
+}
+
+// Free swap slot slot once it is no longer needed.
+// Does not sleep, so it can be called from freevm().
+void swapfree(uint slot) {
+	acquire(&swapmap.lock);
+	if (slot >= NSWAP || swapmap.state[slot] == SWAP_FREE)
+		panic("swapfree");
+	if (swapmap.state[slot] == SWAP_WRITING)
+		swapmap.state[slot] = SWAP_DROPPED;  // swapout() frees it
+	else
+		swapmap.state[slot] = SWAP_FREE;
+	release(&swapmap.lock);
+}
+
+// Read the page in swap slot slot into page. The slot stays
+// allocated; the caller frees it if the page no longer needs it.
+void swapread(uint slot, char *page) {
+	acquiresleep(&swapio);  // waits out a write to the slot
+	swaprw(page, slot, 0);
+	releasesleep(&swapio);
+}
+
+// Evict one cold user page to swap.
+// Returns 0, or -1 if there was no free slot or no page to evict.
+int swapout(void) {
+	char *page;
+	int slot;
+
+	acquiresleep(&swapio);
+	acquire(&swapmap.lock);
+	for (slot = 0; slot < NSWAP; slot++)
+		if (swapmap.state[slot] == SWAP_FREE)
+			break;
+	if (slot == NSWAP) {
+		release(&swapmap.lock);
+		releasesleep(&swapio);
+		return -1;
+	}
+	swapmap.state[slot] = SWAP_WRITING;
+	release(&swapmap.lock);
+
+	// the victim's PTE now points at slot
+	if ((page = swapvictim(slot)) == 0) {
+		acquire(&swapmap.lock);
+		swapmap.state[slot] = SWAP_FREE;
+		release(&swapmap.lock);
+		releasesleep(&swapio);
+		return -1;
+	}
+	swaprw(page, slot, 1);
+
+	acquire(&swapmap.lock);
+	if (swapmap.state[slot] == SWAP_DROPPED)
+		swapmap.state[slot] = SWAP_FREE;
+	else
+		swapmap.state[slot] = SWAP_USED;
+	release(&swapmap.lock);
+	releasesleep(&swapio);
+	kfree(page);
+	return 0;
+}
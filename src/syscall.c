@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "fcntl.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -13,11 +14,36 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
+// Return the end of the user memory that holds addr in p:
+// the process image [0, sz) or a mapping. 0 if none does.
+static uint uend(struct proc *p, uint addr) {
+	struct vma *v;
+
+	if (addr < p->sz)
+		return p->sz;
+	if ((v = vmalookup(p, addr)) != 0)
+		return v->end;
+	return 0;
+}
+
+// Page in [addr, addr+n) of the current process and keep it from
+// being swapped out until the system call returns. (Pin first:
+// paging in may sleep, and the pages already in must stay.)
+static int pin(struct proc *p, uint addr, uint n) {
+	if (p->pinhi == 0 || addr < p->pinlo)
+		p->pinlo = addr;
+	if (addr + n > p->pinhi)
+		p->pinhi = addr + n;
+	return uvmpagein(p, addr, n);
+}
+
 // Fetch the int at addr from the current process.
 int fetchint(uint addr, int *ip) {
 	struct proc *curproc = myproc();
+	uint end;
 
-	if (addr >= curproc->sz || addr + 4 > curproc->sz)
+	end = uend(curproc, addr);
+	if (end == 0 || addr + 4 > end || pin(curproc, addr, 4) < 0)
 		return -1;
 	*ip = *(int*) (addr);
 	return 0;
@@ -30,11 +56,13 @@ int fetchstr(uint addr, char **pp) {
 	char *s, *ep;
 	struct proc *curproc = myproc();
 
-	if (addr >= curproc->sz)
+	if ((ep = (char*) uend(curproc, addr)) == 0)
 		return -1;
 	*pp = (char*) addr;
-	ep = (char*) curproc->sz;
 	for (s = *pp; s < ep; s++) {
+		if ((s == *pp || (uint) s % PGSIZE == 0)
+				&& pin(curproc, (uint) s, 1) < 0)
+			return -1;
 		if (*s == 0)
 			return s - *pp;
 	}
@@ -51,20 +79,37 @@ int argint(int n, int *ip) {
 // lies within the process address space.
 int argptr(int n, char **pp, int size) {
 	int i;
+	uint end;
 	struct proc *curproc = myproc();
 
 	if (argint(n, &i) < 0)
 		return -1;
-	if (size < 0 || (uint) i >= curproc->sz || (uint) i + size > curproc->sz)
+	end = uend(curproc, i);
+	if (size < 0 || end == 0 || (uint) i + size > end
+			|| pin(curproc, i, size) < 0)
 		return -1;
 	*pp = (char*) i;
 	return 0;
 }
 
+// Like argptr(), for a block of memory the kernel will write
+// to: a mapping it lies in must also be writable, since a write
+// by the kernel to a read-only page would fault.
+int argoutptr(int n, char **pp, int size) {
+	struct vma *v;
+
+	if (argptr(n, pp, size) < 0)
+		return -1;
+	v = vmalookup(myproc(), (uint) *pp);
+	if (v && (v->prot & PROT_WRITE) == 0)
+		return -1;
+	return 0;
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (A string in shared memory can change between this check and
+// being used by the kernel, but it stays within the mapping.)
 int argstr(int n, char **pp) {
 	int addr;
 	if (argint(n, &addr) < 0)
@@ -100,6 +145,16 @@ extern int sys_thread_join(void);
 extern int sys_thread_exit(void);
 extern int sys_mysleep(void);
 extern int sys_mywakeup(void);
+extern int sys_kmemstat(void);
+extern int sys_bigheap(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_msync(void);
+extern int sys_rsslimit(void);
+extern int sys_iostat(void);
 
 static int (*syscalls[])(void) = {
 	[SYS_fork] sys_fork,
@@ -129,7 +184,17 @@ static int (*syscalls[])(void) = {
 	[SYS_thread_join] sys_thread_join,
 	[SYS_thread_exit] sys_thread_exit,
 	[SYS_mysleep] sys_mysleep,
-	[SYS_mywakeup] sys_mywakeup
+	[SYS_mywakeup] sys_mywakeup,
+	[SYS_kmemstat] sys_kmemstat,
+	[SYS_bigheap] sys_bigheap,
+	[SYS_shmget] sys_shmget,
+	[SYS_shmat] sys_shmat,
+	[SYS_shmdt] sys_shmdt,
+	[SYS_mmap] sys_mmap,
+	[SYS_munmap] sys_munmap,
+	[SYS_msync] sys_msync,
+	[SYS_rsslimit] sys_rsslimit,
+	[SYS_iostat] sys_iostat
 };
 
 /**
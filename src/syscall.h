@@ -27,3 +27,13 @@
 #define SYS_thread_exit   26
 #define SYS_mysleep       27
 #define SYS_mywakeup      28
+#define SYS_kmemstat      29
+#define SYS_bigheap       30
+#define SYS_shmget        31
+#define SYS_shmat         32
+#define SYS_shmdt         33
+#define SYS_mmap          34
+#define SYS_munmap        35
+#define SYS_msync         36
+#define SYS_rsslimit      37
+#define SYS_iostat        38
@@ -76,7 +76,7 @@ int sys_read(void) {
 	int n;
 	char *p;
 
-	if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+	if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argoutptr(1, &p, n) < 0)
 		return -1;
 	return fileread(f, p, n);
 }
@@ -109,7 +109,7 @@ int sys_fstat(void) {
 	struct file *f;
 	struct stat *st;
 
-	if (argfd(0, 0, &f) < 0 || argptr(1, (void*) &st, sizeof(*st)) < 0)
+	if (argfd(0, 0, &f) < 0 || argoutptr(1, (void*) &st, sizeof(*st)) < 0)
 		return -1;
 	return filestat(f, st);
 }
@@ -327,6 +327,7 @@ int sys_open(void) {
 	f->type = FD_INODE;
 	f->ip = ip;
 	f->off = 0;
+	memset(&f->ra, 0, sizeof(f->ra));
 	f->readable = !(omode & O_WRONLY);
 	f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
@@ -420,7 +421,7 @@ int sys_pipe(void) {
 	struct file *rf, *wf;
 	int fd0, fd1;
 
-	if (argptr(0, (void*) &fd, 2 * sizeof(fd[0])) < 0)
+	if (argoutptr(0, (void*) &fd, 2 * sizeof(fd[0])) < 0)
 		return -1;
 
 	// allocate a pipe struct and hung on read file
@@ -442,3 +443,46 @@ int sys_pipe(void) {
 	fd[1] = fd1;
 	return 0;
 }
+
+// mmap(fd, off, len, prot, flags): map len bytes of the file
+// open as fd from offset off, or zeroed memory with MAP_ANON
+// (fd is ignored); returns the address
+int sys_mmap(void) {
+	struct file *f;
+	int off, len, prot, flags, type;
+
+	if (argint(1, &off) < 0 || argint(2, &len) < 0 || argint(3, &prot) < 0
+			|| argint(4, &flags) < 0 || off < 0)
+		return -1;
+	if (flags & MAP_ANON)
+		return mmap(0, off, len, prot, flags);
+
+	if (argfd(0, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+		return -1;
+	if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+		return -1;
+	ilock(f->ip);
+	type = f->ip->type;
+	iunlock(f->ip);
+	if (type != T_FILE)
+		return -1;
+	return mmap(f, off, len, prot, flags);
+}
+
+// munmap(addr, len): remove the whole mapping at addr
+int sys_munmap(void) {
+	int addr, len;
+
+	if (argint(0, &addr) < 0 || argint(1, &len) < 0)
+		return -1;
+	return munmap(addr, len);
+}
+
+// msync(addr, len): write back shared file mappings in the range
+int sys_msync(void) {
+	int addr, len;
+
+	if (argint(0, &addr) < 0 || argint(1, &len) < 0)
+		return -1;
+	return msync(addr, len);
+}
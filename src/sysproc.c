@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "iostat.h"
 
 int sys_fork(void) {
 	return fork();
@@ -79,10 +80,10 @@ int sys_dump(void) {
 	char * addr;
 	char * buffer;
 	uint buffersize;
-	if (argint(0, &pid) < 0 || argptr(1, &addr, sizeof(addr)) < 0
-			|| argptr(2, &buffer, sizeof(buffer)) < 0
-			|| argint(3, (int*) &buffersize) < 0) {
-		panic("sys_dump: args error");
+	// addr is in pid's address space, not the caller's
+	if (argint(0, &pid) < 0 || argint(1, (int*) &addr) < 0
+			|| argint(3, (int*) &buffersize) < 0
+			|| argoutptr(2, &buffer, buffersize) < 0) {
 		return -1;
 	}
 	return dump(pid, addr, buffer, buffersize);
@@ -91,6 +92,22 @@ int sys_dump(void) {
 int sys_ps(void) {
 	return ps();
 }
+
+// Limit the resident pages of the address space to n, or lift
+// the limit if n is 0: sbrk() fails rather than grow past it.
+// Returns the old limit.
+int sys_rsslimit(void) {
+	struct vmacct *a;
+	uint old;
+	int n;
+
+	if (argint(0, &n) < 0 || n < 0)
+		return -1;
+	a = vmacct(myproc()->pgdir);
+	old = a->rsslimit;
+	a->rsslimit = n;
+	return old;
+}
 // sys_clone
 int sys_thread_create(void) {
 	void (*fcn)(void*), *arg, *stack;
@@ -122,3 +139,66 @@ int sys_mywakeup(void) {
 	argptr(0, (void*) &arg1, sizeof(void *));
 	return mywakeup(arg1);
 }
+
+// copy the number of free blocks of each buddy order,
+// nfree[0..KMAXORDER], out to user space
+int sys_kmemstat(void) {
+	int *nfree;
+
+	if (argoutptr(0, (void*) &nfree, (KMAXORDER + 1) * sizeof(int)) < 0)
+		return -1;
+	kmemstat(nfree);
+	return 0;
+}
+
+// iostat(st): copy buffer cache and disk counters out to st
+int sys_iostat(void) {
+	struct iostat *st;
+
+	if (argoutptr(0, (void*) &st, sizeof(*st)) < 0)
+		return -1;
+	memset(st, 0, sizeof(*st));
+	biostat(st);
+	idestat(st);
+	return 0;
+}
+
+// bigheap(on): if on, back later heap growth with 4 MB pages
+// where it covers whole 4 MB-aligned regions; returns old setting
+int sys_bigheap(void) {
+	int on, old;
+
+	if (argint(0, &on) < 0)
+		return -1;
+	old = myproc()->bigheap;
+	myproc()->bigheap = on != 0;
+	return old;
+}
+
+// shmget(key, size): id of the shared memory segment with
+// this key, created with size bytes if need be
+int sys_shmget(void) {
+	int key, size;
+
+	if (argint(0, &key) < 0 || argint(1, &size) < 0)
+		return -1;
+	return shmget(key, size);
+}
+
+// shmat(id): map segment id, returning its address
+int sys_shmat(void) {
+	int id;
+
+	if (argint(0, &id) < 0)
+		return -1;
+	return shmat(id);
+}
+
+// shmdt(addr): unmap the segment attached at addr
+int sys_shmdt(void) {
+	int addr;
+
+	if (argint(0, &addr) < 0)
+		return -1;
+	return shmdt(addr);
+}
@@ -41,7 +41,9 @@ void trap(struct trapframe *tf) {
 		if (myproc()->killed)
 			exit();
 		myproc()->tf = tf; // save trap frame to process
+		myproc()->pinlo = myproc()->pinhi = 0;
 		syscall(); // execute system call
+		myproc()->pinlo = myproc()->pinhi = 0;
 		if (myproc()->killed)
 			exit();
 		return;
@@ -80,6 +82,15 @@ void trap(struct trapframe *tf) {
 		lapiceoi();
 		break;
 
+	case T_PGFLT:
+		// first touch of a mapped or stack page, or a swapped out
+		// one; the kernel pages in what it uses of user memory (see
+		// uvmpagein) and must not fault
+		if (myproc() && (tf->cs & 3) == DPL_USER
+				&& pagefault(rcr2(), tf->err) == 0)
+			break;
+		// fall through
+
 		//PAGEBREAK: 13
 	default:
 		if (myproc() == 0 || (tf->cs & 3) == 0) {
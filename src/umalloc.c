@@ -2,89 +2,506 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "fcntl.h"
+#include "x86.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator with segregated size classes.
+//
+// Small requests (up to MAXSMALL bytes) are rounded up to one of
+// NCLASS size classes and served from spans: runs of pages cut
+// into objects of a single class, each span with its own free
+// list. Medium requests (up to MAXMEDIUM pages) get a run of
+// whole pages from the page heap, which grows with sbrk() and
+// keeps its free runs on lists by length, merged with free
+// neighbours. Large requests get their own anonymous mmap().
+//
+// Objects carry no header: free() finds the span an address is
+// in through a two-level page map, laid out like a page table,
+// so both malloc() and free() take constant time.
+//
+// Threads share the heap. Small objects go through NCACHE caches
+// of free objects per class, picked by the page of the caller's
+// stack, so that threads (each on its own stack) mostly use a
+// cache of their own. A cache takes CACHEMAX/2 objects at a time
+// from the spans and gives half back once it holds more than
+// CACHEMAX; only then, and for medium and large objects, is
+// heaplock taken. A cache outlives the threads that use it, so
+// nothing is lost when one exits.
 
-typedef long Align;
+#define PGSIZE     4096
+#define PGSHIFT    12
+#define MAXSMALL   2048      // largest small object
+#define MAXMEDIUM  64        // pages in the largest medium object
+#define HEAPGROW   64        // pages to sbrk() at least at a time
+#define NCACHE     8         // small object caches
+#define CACHEMAX   32        // objects of a class a cache holds at most
 
-union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
+// span states
+#define SPAN_FREE  0         // free run in the page heap
+#define SPAN_USED  1         // small object span or medium object
+#define SPAN_LARGE 2         // large object, mmap()ed
+
+struct span {
+  uint start;                // address of first page
+  uint npages;
+  int state;
+  int class;                 // size class of small objects, or -1
+  void *free;                // small: free objects, linked through first word
+  uint nfree;                // small: objects on free
+  struct span *next;         // on a class or page heap list
+  struct span *prev;
 };
 
-typedef union header Header;
+static ushort classsize[] = {
+  16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384,
+  512, 640, 768, 1024, 1280, 1536, 2048,
+};
+#define NCLASS (sizeof(classsize)/sizeof(classsize[0]))
 
-static Header base;
-static Header *freep;
+static uchar sizeclass[MAXSMALL/16 + 1];   // (size+15)/16 -> class
+static struct span partial[NCLASS];        // spans with free objects, per class
+static struct span runs[MAXMEDIUM + 1];    // free runs of n pages; >= MAXMEDIUM last
+static struct span *spanfree;              // unused span descriptors
+static struct span **pagemap[1024];        // page number -> span, two levels
+static char *metap, *metaend;              // bump allocator for the above
+static volatile int ready;
+static volatile uint heaplock;             // protects all of the above
 
-void
-free(void *ap)
+struct cache {
+  volatile uint lock;
+  void *list[NCLASS];        // free objects, linked through first word
+  uint n[NCLASS];            // objects on list
+};
+static struct cache caches[NCACHE];
+
+static void
+lock(volatile uint *l)
 {
-  Header *bp, *p;
+  while(xchg(l, 1) != 0)
+    ;
+  __sync_synchronize();
+}
 
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
-}
-
-static Header*
-morecore(uint nu)
+static void
+unlock(volatile uint *l)
 {
+  __sync_synchronize();
+  asm volatile("movl $0, %0" : "+m" (*l) : );
+}
+
+// The cache of the calling thread.
+static struct cache*
+mycache(void)
+{
+  uint sp;
+
+  return &caches[((uint)&sp >> PGSHIFT) % NCACHE];
+}
+
+static void
+listinit(struct span *h)
+{
+  h->next = h->prev = h;
+}
+
+static void
+listpush(struct span *h, struct span *s)
+{
+  s->next = h->next;
+  s->prev = h;
+  h->next->prev = s;
+  h->next = s;
+}
+
+static void
+listremove(struct span *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+// Grow the heap by n pages, page aligned. Returns 0 on failure.
+static char*
+morepages(uint n)
+{
+  uint brk;
   char *p;
-  Header *hp;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
+  brk = (uint)sbrk(0);
+  if(brk % PGSIZE && sbrk(PGSIZE - brk % PGSIZE) == (char*)-1)
+    return 0;
+  p = sbrk(n * PGSIZE);
   if(p == (char*)-1)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  return p;
+}
+
+// Allocator metadata: page map leaves and span descriptors.
+// Never freed.
+static void*
+metaalloc(uint n)
+{
+  char *p;
+
+  if(metap == 0 || metap + n > metaend){
+    if((metap = morepages(1)) == 0)
+      return 0;
+    metaend = metap + PGSIZE;
+  }
+  p = metap;
+  metap += n;
+  return p;
+}
+
+static struct span*
+spanalloc(void)
+{
+  struct span *s;
+
+  if((s = spanfree) != 0)
+    spanfree = s->next;
+  else if((s = metaalloc(sizeof(*s))) == 0)
+    return 0;
+  memset(s, 0, sizeof(*s));
+  return s;
+}
+
+static void
+spanrelease(struct span *s)
+{
+  s->next = spanfree;
+  spanfree = s;
+}
+
+static struct span*
+lookup(uint a)
+{
+  struct span **leaf;
+
+  if((leaf = pagemap[a >> 22]) == 0)
+    return 0;
+  return leaf[(a >> PGSHIFT) & 1023];
+}
+
+// Point the page map entry of page a at s.
+static int
+setmap(uint a, struct span *s)
+{
+  struct span ***l;
+
+  l = &pagemap[a >> 22];
+  if(*l == 0){
+    if((*l = metaalloc(1024 * sizeof(struct span*))) == 0)
+      return -1;
+    memset(*l, 0, 1024 * sizeof(struct span*));
+  }
+  (*l)[(a >> PGSHIFT) & 1023] = s;
+  return 0;
+}
+
+// Map every page of s to s.
+static int
+mapspan(struct span *s)
+{
+  uint i;
+
+  for(i = 0; i < s->npages; i++)
+    if(setmap(s->start + i * PGSIZE, s) < 0)
+      return -1;
+  return 0;
+}
+
+static void
+init(void)
+{
+  uint i, c;
+
+  for(c = i = 0; i <= MAXSMALL/16; i++){
+    while(classsize[c] < i * 16)
+      c++;
+    sizeclass[i] = c;
+  }
+  for(i = 0; i < NCLASS; i++)
+    listinit(&partial[i]);
+  for(i = 0; i <= MAXMEDIUM; i++)
+    listinit(&runs[i]);
+  __sync_synchronize();
+  ready = 1;
+}
+
+//PAGEBREAK!
+// Page heap. Called with heaplock held.
+
+// Put free run s on its list, merged with free neighbours.
+static void
+pagefree(struct span *s)
+{
+  struct span *t;
+
+  s->state = SPAN_FREE;
+  if((t = lookup(s->start - PGSIZE)) != 0 && t->state == SPAN_FREE){
+    listremove(t);
+    t->npages += s->npages;
+    spanrelease(s);
+    s = t;
+  }
+  if((t = lookup(s->start + s->npages * PGSIZE)) != 0 && t->state == SPAN_FREE){
+    listremove(t);
+    s->npages += t->npages;
+    spanrelease(t);
+  }
+  // the ends are enough for merging
+  setmap(s->start, s);
+  setmap(s->start + (s->npages - 1) * PGSIZE, s);
+  listpush(&runs[s->npages < MAXMEDIUM ? s->npages : MAXMEDIUM], s);
+}
+
+// Allocate a run of n pages, n <= MAXMEDIUM. Returns 0 on failure.
+static struct span*
+pagealloc(uint n)
+{
+  struct span *s, *t;
+  uint i;
+  char *p;
+
+  for(;;){
+    s = 0;
+    for(i = n; i < MAXMEDIUM && s == 0; i++)
+      if(runs[i].next != &runs[i])
+        s = runs[i].next;
+    for(t = runs[MAXMEDIUM].next; s == 0 && t != &runs[MAXMEDIUM]; t = t->next)
+      if(t->npages >= n)
+        s = t;
+    if(s)
+      break;
+    // grow the heap by a new free run
+    if((t = spanalloc()) == 0)
+      return 0;
+    if((p = morepages(n > HEAPGROW ? n : HEAPGROW)) == 0){
+      spanrelease(t);
+      return 0;
+    }
+    t->start = (uint)p;
+    t->npages = n > HEAPGROW ? n : HEAPGROW;
+    pagefree(t);
+  }
+  listremove(s);
+  s->state = SPAN_USED;
+  s->class = -1;
+  t = 0;
+  if(s->npages > n){
+    if((t = spanalloc()) == 0){
+      pagefree(s);
+      return 0;
+    }
+    t->start = s->start + n * PGSIZE;
+    t->npages = s->npages - n;
+    s->npages = n;
+  }
+  // map s before giving back the tail, which looks up its last page
+  if(mapspan(s) < 0){
+    if(t){
+      s->npages += t->npages;
+      spanrelease(t);
+    }
+    pagefree(s);
+    return 0;
+  }
+  if(t)
+    pagefree(t);
+  return s;
+}
+
+//PAGEBREAK!
+// Small objects. Called with heaplock held.
+
+static void*
+smallalloc(uint c)
+{
+  struct span *s;
+  uint size, a;
+  void *p;
+
+  s = partial[c].next;
+  if(s == &partial[c]){
+    // a new span, cut into objects
+    size = classsize[c];
+    if((s = pagealloc((size * 8 + PGSIZE - 1) / PGSIZE)) == 0)
+      return 0;
+    s->class = c;
+    s->free = 0;
+    s->nfree = 0;
+    for(a = s->start; a + size <= s->start + s->npages * PGSIZE; a += size){
+      *(void**)a = s->free;
+      s->free = (void*)a;
+      s->nfree++;
+    }
+    listpush(&partial[c], s);
+  }
+  p = s->free;
+  s->free = *(void**)p;
+  if(--s->nfree == 0)
+    listremove(s);
+  return p;
+}
+
+static void
+smallfree(struct span *s, void *p)
+{
+  *(void**)p = s->free;
+  s->free = p;
+  if(++s->nfree == 1)
+    listpush(&partial[s->class], s);
+  else if(s->nfree == s->npages * PGSIZE / classsize[s->class]
+          && (s->next != &partial[s->class] || s->prev != &partial[s->class])){
+    // all free, and not the class's only span: return the pages
+    listremove(s);
+    pagefree(s);
+  }
+}
+
+//PAGEBREAK!
+// Medium and large objects. Called with heaplock held.
+
+static void*
+bigalloc(uint nbytes)
+{
+  struct span *s;
+  uint n;
+  char *p;
+
+  // also keeps n from wrapping around to 0
+  if(nbytes > 0x7FFFFFFF)
+    return 0;
+  n = (nbytes + PGSIZE - 1) / PGSIZE;
+  if(n <= MAXMEDIUM){
+    if((s = pagealloc(n)) == 0)
+      return 0;
+    return (void*)s->start;
+  }
+
+  // large: a mapping of its own
+  if((s = spanalloc()) == 0)
+    return 0;
+  p = mmap(-1, 0, n * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON);
+  if(p == (char*)-1){
+    spanrelease(s);
+    return 0;
+  }
+  s->start = (uint)p;
+  s->npages = n;
+  s->state = SPAN_LARGE;
+  s->class = -1;
+  if(setmap(s->start, s) < 0){
+    munmap(p, n * PGSIZE);
+    spanrelease(s);
+    return 0;
+  }
+  return p;
+}
+
+static void
+bigfree(struct span *s)
+{
+  if(s->state == SPAN_USED)
+    pagefree(s);
+  else if(s->state == SPAN_LARGE){
+    setmap(s->start, 0);
+    munmap((void*)s->start, s->npages * PGSIZE);
+    spanrelease(s);
+  }
+}
+
+//PAGEBREAK!
+// Caches. Called with k->lock held.
+
+static void
+refill(struct cache *k, uint c)
+{
+  void *p;
+  int i;
+
+  lock(&heaplock);
+  for(i = 0; i < CACHEMAX/2; i++){
+    if((p = smallalloc(c)) == 0)
+      break;
+    *(void**)p = k->list[c];
+    k->list[c] = p;
+    k->n[c]++;
+  }
+  unlock(&heaplock);
+}
+
+static void
+drain(struct cache *k, uint c)
+{
+  void *p;
+  int i;
+
+  lock(&heaplock);
+  for(i = 0; i < CACHEMAX/2; i++){
+    p = k->list[c];
+    k->list[c] = *(void**)p;
+    k->n[c]--;
+    smallfree(lookup((uint)p), p);
+  }
+  unlock(&heaplock);
 }
 
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
-
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+  struct cache *k;
+  void *p;
+  uint c;
+
+  if(!ready){
+    lock(&heaplock);
+    if(!ready)
+      init();
+    unlock(&heaplock);
+  }
+  if(nbytes > MAXSMALL){
+    lock(&heaplock);
+    p = bigalloc(nbytes);
+    unlock(&heaplock);
+    return p;
+  }
+
+  c = sizeclass[(nbytes + 15) / 16];
+  k = mycache();
+  lock(&k->lock);
+  if(k->n[c] == 0)
+    refill(k, c);
+  if((p = k->list[c]) != 0){
+    k->list[c] = *(void**)p;
+    k->n[c]--;
+  }
+  unlock(&k->lock);
+  return p;
+}
+
+void
+free(void *ap)
+{
+  struct cache *k;
+  struct span *s;
+
+  // The page map entries of an allocated object do not change
+  // until it is freed, so no lock is needed to look it up.
+  if(ap == 0 || (s = lookup((uint)ap)) == 0)
+    return;
+  if(s->state == SPAN_USED && s->class >= 0){
+    k = mycache();
+    lock(&k->lock);
+    *(void**)ap = k->list[s->class];
+    k->list[s->class] = ap;
+    if(++k->n[s->class] > CACHEMAX)
+      drain(k, s->class);
+    unlock(&k->lock);
+    return;
   }
+  lock(&heaplock);
+  bigfree(s);
+  unlock(&heaplock);
 }
@@ -1,5 +1,6 @@
 struct stat;
 struct rtcdate;
+struct iostat;
 
 // system calls
 int fork(void);
@@ -30,6 +31,16 @@ int thread_join(void);
 int thread_exit(void);
 int mysleep(void*, void*);
 int mywakeup(void*);
+int kmemstat(int*);
+int bigheap(int);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+void* mmap(int, int, int, int, int);
+int munmap(void*, int);
+int msync(void*, int);
+int rsslimit(int);
+int iostat(struct iostat*);
 
 // ulib.c
 int stat(char*, struct stat*);
@@ -4,12 +4,61 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "elf.h"
+#include "fcntl.h"
+#include "fs.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+// Mappings and accounting (see struct vmspace). An address space
+// has a slot from setupkvm() to freevm(), which mapping a page
+// finds from the pgdir alone: PDE ACCTPDX holds the slot's address.
+// No user memory reaches that PDE (the heap and mappings stay below
+// MMAPTOP, the stack starts higher), so it is never present, and
+// the hardware ignores the rest of it. Counts change atomically:
+// threads sharing a pgdir may fault on several CPUs at once.
+// vmtable.lock guards slot allocation, users and the vma types.
+#define ACCTPDX PDX(MMAPTOP)
+
+static struct {
+	struct spinlock lock;
+	struct vmspace space[2 * NPROC];  // exec() holds two pgdirs
+} vmtable;
+
+// The slot of pgdir, or 0 if it has none (kpgdir).
+struct vmspace* vmspace(pde_t *pgdir) {
+	if (pgdir == 0 || pgdir == kpgdir)
+		return 0;
+	return (struct vmspace*) pgdir[ACCTPDX];
+}
+
+// The accounting of pgdir, or 0 if it has none.
+struct vmacct* vmacct(pde_t *pgdir) {
+	struct vmspace *s;
+
+	if ((s = vmspace(pgdir)) == 0)
+		return 0;
+	return &s->acct;
+}
+
+// Add rss resident, ptpages page table and shared shared pages
+// to the counts of pgdir.
+void vmcount(pde_t *pgdir, int rss, int ptpages, int shared) {
+	struct vmacct *a;
+
+	if ((a = vmacct(pgdir)) == 0)
+		return;
+	if (rss)
+		__sync_fetch_and_add(&a->rss, rss);
+	if (ptpages)
+		__sync_fetch_and_add(&a->ptpages, ptpages);
+	if (shared)
+		__sync_fetch_and_add(&a->shared, shared);
+}
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void seginit(void) {
@@ -40,15 +89,18 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc) {
 	pte_t *pgtab;
 
 	pde = &pgdir[PDX(va)];
+	// a 4 MB page has no second level; callers must check PTE_PS first
+	if ((*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+		panic("walkpgdir: 4 MB page");
 	// if pde(this is at first level) point to an allocated page -- second level page table
 	if (*pde & PTE_P) {
 		pgtab = (pte_t*) P2V(PTE_ADDR(*pde));
 	} else {
 		// if pde in pgdir hasn't allocated
-		if (!alloc || (pgtab = (pte_t*) kalloc()) == 0)
-			return 0;
 		// Make sure all those PTE_P bits are zero.
-		memset(pgtab, 0, PGSIZE);
+		if (!alloc || (pgtab = (pte_t*) kalloc_zeroed()) == 0)
+			return 0;
+		vmcount(pgdir, 0, 1, 0);
 		// The permissions here are overly generous, but they can
 		// be further restricted by the permissions in the page table
 		// entries, if necessary.
@@ -78,6 +130,8 @@ static int mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm) {
 			panic("remap");
 		// setup pte, map physical to this pte (va is pte's index)
 		*pte = pa | perm | PTE_P;
+		if ((uint) a < KERNBASE)
+			vmcount(pgdir, 1, 0, (perm & PTE_SHARED) ? 1 : 0);
 		if (a == last)
 			break;
 		a += PGSIZE;
@@ -86,6 +140,30 @@ static int mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm) {
 	return 0;
 }
 
+// Like mappages(), but map every 4 MB-aligned stretch of at least
+// 4 MB with a single 4 MB page (PTE_PS) and no page table page.
+// Only the unaligned ends get 4 KB PTEs. For the kernel's mappings.
+static int kmappages(pde_t *pgdir, uint va, uint size, uint pa, int perm) {
+	uint n;
+
+	while (size > 0) {
+		if (va % PDSIZE == 0 && pa % PDSIZE == 0 && size >= PDSIZE) {
+			if (pgdir[PDX(va)] & PTE_P)
+				panic("remap");
+			pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+			n = PDSIZE;
+		} else {
+			if (mappages(pgdir, (void*) va, PGSIZE, pa, perm) < 0)
+				return -1;
+			n = PGSIZE;
+		}
+		va += n;
+		pa += n;
+		size -= n;
+	}
+	return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -101,13 +179,18 @@ static int mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm) {
 //		mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data:
 //		mapped to EXTMEM..V2P(data) for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP:
-//		mapped to V2P(data)..PHYSTOP, rw data + free physical memory
-//   0xfe000000..0: mapped direct (devices such as ioapic)
+//   data..KERNBASE+phystop:
+//		mapped to V2P(data)..phystop, rw data + free physical memory
+//		(with 4 MB pages from the first 4 MB boundary up)
+//   0xfe000000..0: mapped direct (devices such as ioapic), 4 MB pages
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop, from
+// the BIOS; see physinit) (directly addressable from end..P2V(phystop)).
+//
+// Only kpgdir owns page tables for KERNBASE..0; every other pgdir's
+// upper PDEs point at those same page tables, so the kernel mappings
+// must never change after kvmalloc().
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
@@ -119,41 +202,72 @@ static struct kmap {
 	int perm;
 } kmap[] = { { (void*) KERNBASE, 0, EXTMEM, PTE_W }, // I/O space
 		{ (void*) KERNLINK, V2P(KERNLINK), V2P(data), 0 }, // kern text + R/O data
-		{ (void*) data, V2P(data), PHYSTOP, PTE_W }, // kern data + memory
+		{ (void*) data, V2P(data), 0, PTE_W }, // kern data + memory, to phystop
 		{ (void*) DEVSPACE, DEVSPACE, 0, PTE_W }, // more devices
 		};
 
 // Set up kernel part of a page table.
-// attention: after first boot to main, we can only kalloc less than 4 MB
+// The kernel half (KERNBASE and up) is identical in every address
+// space, so its second-level page tables are built once by kvmalloc()
+// and shared: a new pgdir only copies the upper PDEs of kpgdir.
 pde_t*
 setupkvm(void) {
 	pde_t *pgdir;
-	struct kmap *k;
+	struct vmspace *s;
 
 	// set one page for pgdir
-	if ((pgdir = (pde_t*) kalloc()) == 0)
+	if ((pgdir = (pde_t*) kalloc_zeroed()) == 0)
 		return 0;
-	memset(pgdir, 0, PGSIZE);
-
-	if (P2V(PHYSTOP) > (void*) DEVSPACE)
-		panic("PHYSTOP too high");
+	acquire(&vmtable.lock);
+	for (s = vmtable.space; s < &vmtable.space[NELEM(vmtable.space)]; s++)
+		if (s->pgdir == 0)
+			break;
+	if (s == &vmtable.space[NELEM(vmtable.space)]) {
+		release(&vmtable.lock);
+		kfree((char*) pgdir);
+		return 0;
+	}
+	memset(s, 0, sizeof(*s));
+	s->pgdir = pgdir;
+	s->users = 1;
+	s->acct.ptpages = 1;
+	release(&vmtable.lock);
+	pgdir[ACCTPDX] = (uint) s;  // PTE_P clear: s is word aligned
 
-	// directly force write kmap data into pgdir
-	// set kernel data into pgdir
-	for (k = kmap; k < &kmap[NELEM(kmap)]; k++)
-		// create PTEs in pgdir mapping physical to virtual
-		if (mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-				(uint) k->phys_start, k->perm) < 0) {
-			freevm(pgdir);
-			return 0;
-		}
+	// point the kernel half at the shared kernel page tables
+	memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+			(NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
 	return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
 // space for scheduler processes.
+// The kernel page tables built here are shared by every later pgdir,
+// so kmap must be fully mapped before the first setupkvm().
 void kvmalloc(void) {
-	kpgdir = setupkvm();
+	struct kmap *k;
+
+	initlock(&vmtable.lock, "vmtable");
+	if (USTACKTOP - USTACKMAX < PGADDR(ACCTPDX + 1, 0, 0))
+		panic("kvmalloc: stack over ACCTPDX");
+	if ((kpgdir = (pde_t*) kalloc()) == 0)
+		panic("kvmalloc: out of memory");
+	memset(kpgdir, 0, PGSIZE);
+
+	kmap[2].phys_end = phystop;  // known only at run time
+	if (P2V(phystop) > (void*) DEVSPACE)
+		panic("PHYSTOP too high");
+
+	// directly force write kmap data into kpgdir
+	// kernel mappings are global: they are the same in every pgdir,
+	// so their TLB entries survive the %cr3 reload on a process switch
+	// the direct map uses 4 MB pages (CR4_PSE is on since entry.S),
+	// which saves its page table pages and widens TLB reach
+	for (k = kmap; k < &kmap[NELEM(kmap)]; k++)
+		// create PTEs in kpgdir mapping physical to virtual
+		if (kmappages(kpgdir, (uint) k->virt, k->phys_end - k->phys_start,
+				(uint) k->phys_start, k->perm | PTE_G) < 0)
+			panic("kvmalloc: mappages");
 	switchkvm();
 }
 
@@ -166,6 +280,8 @@ void switchkvm(void) {
 
 // Switch TSS and h/w page table to correspond to process p.
 // load TSS and process pgdir
+// %cr3 is only reloaded when p's pgdir is not the one this CPU already
+// has loaded, e.g. when switching between threads of one process.
 void switchuvm(struct proc *p) {
 	if (p == 0)
 		panic("switchuvm: no process");
@@ -186,7 +302,10 @@ void switchuvm(struct proc *p) {
 	ltr(SEG_TSS << 3);
 
 	// load new pgdir
-	lcr3(V2P(p->pgdir));  // switch to process's address space
+	if (mycpu()->pgdir != p->pgdir) {
+		lcr3(V2P(p->pgdir));  // switch to process's address space
+		mycpu()->pgdir = p->pgdir;
+	}
 	popcli();
 }
 
@@ -199,8 +318,7 @@ void inituvm(pde_t *pgdir, char *init, uint sz) {
 		panic("inituvm: more than a page");
 
 	// initial first page of first process
-	mem = kalloc();
-	memset(mem, 0, PGSIZE);
+	mem = kalloc_zeroed();
 	// map page to pgdir
 	mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W | PTE_U);
 	memmove(mem, init, sz);
@@ -209,12 +327,17 @@ void inituvm(pde_t *pgdir, char *init, uint sz) {
 // Load a program segment into pgdir.  addr must be page-aligned
 // and the pages from addr to addr+sz must already be mapped.
 int loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz) {
-	uint i, pa, n;
+	uint i, pa, n, nb;
 	pte_t *pte;
 
 	if ((uint) addr % PGSIZE != 0)
 		panic("loaduvm: addr must be page aligned");
 	for (i = 0; i < sz; i += PGSIZE) {
+		// keep the disk busy with the next RAMAX blocks
+		if (i % (RAMAX * BSIZE / 2) == 0) {
+			nb = (offset + sz + BSIZE - 1) / BSIZE - (offset + i) / BSIZE;
+			ireadahead(ip, (offset + i) / BSIZE, nb < RAMAX ? nb : RAMAX);
+		}
 		if ((pte = walkpgdir(pgdir, addr + i, 0)) == 0)
 			panic("loaduvm: address should exist");
 		pa = PTE_ADDR(*pte);
@@ -228,6 +351,18 @@ int loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz) {
 	return 0;
 }
 
+// Allocate a zeroed page for user memory, shrinking the buffer
+// cache, then evicting pages to swap, while there is none free.
+// May sleep.
+static char* ualloc(void) {
+	char *mem;
+
+	while ((mem = kalloc_zeroed()) == 0)
+		if (bshrink() < 0 && swapout() < 0)
+			return 0;
+	return mem;
+}
+
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 // allocate virtual page as we want--sequentially, and map it to some unknown physical page
@@ -242,13 +377,12 @@ int allocuvm(pde_t *pgdir, uint oldsz, uint newsz) {
 
 	a = PGROUNDUP(oldsz);
 	for (; a < newsz; a += PGSIZE) {
-		mem = kalloc();
+		mem = ualloc();
 		if (mem == 0) {
 			cprintf("allocuvm out of memory\n");
 			deallocuvm(pgdir, newsz, oldsz);
 			return 0;
 		}
-		memset(mem, 0, PGSIZE);
 		if (mappages(pgdir, (char*) a, PGSIZE, V2P(mem), PTE_W | PTE_U) < 0) {
 			cprintf("allocuvm out of memory (2)\n");
 			deallocuvm(pgdir, newsz, oldsz);
@@ -259,54 +393,132 @@ int allocuvm(pde_t *pgdir, uint oldsz, uint newsz) {
 	return newsz;
 }
 
+// Like allocuvm(), but back every 4 MB-aligned, 4 MB stretch of
+// [oldsz, newsz) that has no page table yet with one 4 MB page.
+// The rest, and stretches no free 4 MB block is found for, get
+// 4 KB pages. Returns new size or 0 on error.
+int allocuvm_pse(pde_t *pgdir, uint oldsz, uint newsz) {
+	char *mem;
+	uint a, next;
+
+	if (newsz >= KERNBASE)
+		return 0;
+	if (newsz < oldsz)
+		return oldsz;
+
+	a = PGROUNDUP(oldsz);
+	while (a < newsz) {
+		if (a % PDSIZE == 0 && newsz - a >= PDSIZE && !(pgdir[PDX(a)] & PTE_P)
+				&& (mem = kalloc_order(PDXSHIFT - PGSHIFT)) != 0) {
+			memset(mem, 0, PDSIZE);
+			pgdir[PDX(a)] = V2P(mem) | PTE_PS | PTE_P | PTE_W | PTE_U;
+			vmcount(pgdir, NPTENTRIES, 0, 0);
+			a += PDSIZE;
+			continue;
+		}
+		// 4 KB pages up to the next 4 MB boundary
+		next = PGADDR(PDX(a) + 1, 0, 0);
+		if (next > newsz)
+			next = newsz;
+		if (allocuvm(pgdir, a, next) == 0) {
+			deallocuvm(pgdir, a, oldsz);
+			return 0;
+		}
+		a = PGROUNDUP(next);
+	}
+	return newsz;
+}
+
+// Turn the 4 MB page mapped by *pde into a page table of 4 KB PTEs,
+// so part of it can be unmapped. The last 4 KB of the 4 MB page
+// becomes the page table itself: callers only demote when shrinking
+// a range that runs to the end of the 4 MB page, so that page is
+// being freed anyway and no allocation is needed.
+static void demote(pde_t *pde) {
+	pte_t *pgtab;
+	uint pa, flags, i;
+
+	pa = PTE_ADDR(*pde) & ~(PDSIZE - 1);
+	flags = PTE_FLAGS(*pde) & ~PTE_PS;
+	pgtab = (pte_t*) P2V(pa + PDSIZE - PGSIZE);
+	for (i = 0; i < NPTENTRIES - 1; i++)
+		pgtab[i] = (pa + i * PGSIZE) | flags;
+	pgtab[NPTENTRIES - 1] = 0;
+	*pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
-// deallocate total pte in both pgdir and pgtab level
+// Only present PDEs are visited, so the cost follows the memory
+// mapped, not the size of the range; a page table whose whole
+// 4 MB lies in the range is freed along with its pages.
 int deallocuvm(pde_t *pgdir, uint oldsz, uint newsz) {
-	pte_t *pte;
-	uint a, pa;
+	pde_t *pde;
+	pte_t *pgtab, *pte;
+	uint a, base, next, end;
+	int rss, pt, shared;
 
 	if (newsz >= oldsz)
 		return oldsz;
 
-	a = PGROUNDUP(newsz);
-	for (; a < oldsz; a += PGSIZE) {
-		pte = walkpgdir(pgdir, (char*) a, 0);
-		if (!pte)
-			a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-		else if ((*pte & PTE_P) != 0) {
-			pa = PTE_ADDR(*pte);
-			if (pa == 0)
-				panic("kfree");
-			char *v = P2V(pa);
-			kfree(v);
+	rss = pt = shared = 0;
+	for (a = PGROUNDUP(newsz); a < oldsz; a = next) {
+		pde = &pgdir[PDX(a)];
+		base = PGADDR(PDX(a), 0, 0);
+		next = base + PDSIZE;
+		if (!(*pde & PTE_P))
+			continue;
+		if (*pde & PTE_PS) {
+			if (a == base && oldsz - a >= PDSIZE) {
+				// the whole 4 MB page goes
+				kfree_order(P2V(PTE_ADDR(*pde) & ~(PDSIZE - 1)),
+						PDXSHIFT - PGSHIFT);
+				*pde = 0;
+				rss -= NPTENTRIES;
+				continue;
+			}
+			demote(pde);
+			rss--;  // the last page is the page table now
+			pt++;
+		}
+		pgtab = (pte_t*) P2V(PTE_ADDR(*pde));
+		end = next < oldsz ? next : oldsz;
+		for (; a < end; a += PGSIZE) {
+			pte = &pgtab[PTX(a)];
+			if (*pte & PTE_P) {
+				kfree(P2V(PTE_ADDR(*pte)));
+				rss--;
+				if (*pte & PTE_SHARED)
+					shared--;
+			} else if (*pte & PTE_SWAP)
+				swapfree(PTE_ADDR(*pte) >> PGSHIFT);
 			*pte = 0;
 		}
+		if (base >= PGROUNDUP(newsz) && oldsz >= next) {
+			kfree((char*) pgtab);
+			*pde = 0;
+			pt--;
+		}
 	}
+	vmcount(pgdir, rss, pt, shared);
 	return newsz;
 }
 
 // Free a page table and all the physical memory pages
 // in the user part.
 void freevm(pde_t *pgdir) {
-	uint i;
-
 	if (pgdir == 0)
 		panic("freevm: no pgdir");
 
-	// deallocate PTEs from 0 to kernel base to become 0 size
+	// frees the user half's page table pages too; the kernel half
+	// points at kpgdir's page tables, which every pgdir shares
 	deallocuvm(pgdir, KERNBASE, 0);
 
-	// attention: in kernel part, only free first level PTEs in pgdir
-	for (i = 0; i < NPDENTRIES; i++) {
-		if (pgdir[i] & PTE_P) {
-			char * v = P2V(PTE_ADDR(pgdir[i]));
-			kfree(v);
-		}
-	}
-
+	acquire(&vmtable.lock);
+	vmspace(pgdir)->pgdir = 0;
+	release(&vmtable.lock);
 	// free self
 	kfree((char*) pgdir);
 }
@@ -323,29 +535,84 @@ void clearpteu(pde_t *pgdir, char *uva) {
 	*pte &= ~PTE_U;
 }
 
-// Given a parent process's page table, create a copy
-// of it for a child.
+// Copy the 4 MB page mapped by pde at va into pgdir d: as a
+// 4 MB page if a free 4 MB block is left, else as 4 KB pages.
+static int copypse(pde_t *d, uint va, pde_t pde) {
+	char *mem, *src;
+	uint i;
+
+	src = P2V(PTE_ADDR(pde) & ~(PDSIZE - 1));
+	if ((mem = kalloc_order(PDXSHIFT - PGSHIFT)) != 0) {
+		memmove(mem, src, PDSIZE);
+		d[PDX(va)] = V2P(mem) | PTE_FLAGS(pde);
+		vmcount(d, NPTENTRIES, 0, 0);
+		return 0;
+	}
+	for (i = 0; i < PDSIZE; i += PGSIZE) {
+		if ((mem = kalloc()) == 0)
+			return -1;
+		memmove(mem, src + i, PGSIZE);
+		if (mappages(d, (void*) (va + i), PGSIZE, V2P(mem),
+				PTE_FLAGS(pde) & ~PTE_PS) < 0) {
+			kfree(mem);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Given a parent process's page table, create a copy of its
+// first *sz bytes for a child. A thread sharing pgdir may shrink
+// the heap while this sleeps; then the copy ends at the first
+// page that is gone, and *sz is set to that.
 pde_t*
-copyuvm(pde_t *pgdir, uint sz) {
+copyuvm(pde_t *pgdir, uint *sz) {
 	pde_t *d;
 	pte_t *pte;
-	uint pa, i, flags;
+	uint i, flags, old;
 	char *mem;
 
 	if ((d = setupkvm()) == 0)
 		return 0;
-	for (i = 0; i < sz; i += PGSIZE) {
-		if ((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-			panic("copyuvm: pte should exist");
-		if (!(*pte & PTE_P))
-			panic("copyuvm: page not present");
-		pa = PTE_ADDR(*pte);
-		flags = PTE_FLAGS(*pte);
-		if ((mem = kalloc()) == 0)
+	vmacct(d)->rsslimit = vmacct(pgdir)->rsslimit;
+	for (i = 0; i < *sz; i += PGSIZE) {
+		if ((pgdir[PDX(i)] & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+			if (copypse(d, i, pgdir[PDX(i)]) < 0)
+				goto bad;
+			i += PDSIZE - PGSIZE;
+			continue;
+		}
+		// allocate first: ualloc() may sleep, and pages of the
+		// parent may be swapped out meanwhile
+		if ((mem = ualloc()) == 0)
 			goto bad;
-		memmove(mem, (char*) P2V(pa), PGSIZE);
-		if (mappages(d, (void*) i, PGSIZE, V2P(mem), flags) < 0)
+		if ((pgdir[PDX(i)] & (PTE_P | PTE_PS)) != PTE_P
+				|| (pte = walkpgdir(pgdir, (void *) i, 0)) == 0
+				|| (*pte & (PTE_P | PTE_SWAP)) == 0) {
+			// shrunk (or changed) while ualloc() or swapread() slept
+			kfree(mem);
+			*sz = i;
+			break;
+		}
+		flags = PTE_FLAGS(*pte);
+		if (*pte & PTE_SWAP) {
+			old = *pte;
+			swapread(PTE_ADDR(old) >> PGSHIFT, mem);
+			if ((pgdir[PDX(i)] & (PTE_P | PTE_PS)) != PTE_P
+					|| *walkpgdir(pgdir, (void *) i, 0) != old) {
+				// a thread paged it in, or shrank the heap,
+				// meanwhile; copy it again
+				kfree(mem);
+				i -= PGSIZE;
+				continue;
+			}
+			flags &= ~PTE_SWAP;
+		} else
+			memmove(mem, (char*) P2V(PTE_ADDR(*pte)), PGSIZE);
+		if (mappages(d, (void*) i, PGSIZE, V2P(mem), flags) < 0) {
+			kfree(mem);
 			goto bad;
+		}
 	}
 	return d;
 
@@ -357,9 +624,18 @@ copyuvm(pde_t *pgdir, uint sz) {
 // Map user virtual address to kernel address.
 char*
 uva2ka(pde_t *pgdir, char *uva) {
+	pde_t pde;
 	pte_t *pte;
 
-	pte = walkpgdir(pgdir, uva, 0);
+	pde = pgdir[PDX(uva)];
+	if ((pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+		if ((pde & PTE_U) == 0)
+			return 0;
+		return (char*) P2V(PTE_ADDR(pde) & ~(PDSIZE - 1))
+				+ ((uint) uva & (PDSIZE - 1) & ~(PGSIZE - 1));
+	}
+	if ((pte = walkpgdir(pgdir, uva, 0)) == 0)
+		return 0;
 	if ((*pte & PTE_P) == 0)
 		return 0;
 	if ((*pte & PTE_U) == 0)
@@ -391,6 +667,418 @@ int copyout(pde_t *pgdir, uint va, void *p, uint len) {
 	return 0;
 }
 
+//PAGEBREAK!
+// Mappings above the heap (see struct vma in proc.h).
+
+// Map the pages pages[0..n-1] at va in pgdir, taking a reference
+// to each (see kincref), so that they are only freed once every
+// page table mapping them has let go. Returns 0, or -1 with
+// nothing left mapped.
+int mapshared(pde_t *pgdir, uint va, char **pages, int n, int perm) {
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (mappages(pgdir, (void*) (va + i * PGSIZE), PGSIZE, V2P(pages[i]),
+				perm | PTE_SHARED) < 0) {
+			deallocuvm(pgdir, va + i * PGSIZE, va);
+			return -1;
+		}
+		kincref(pages[i]);
+	}
+	return 0;
+}
+
+// The vmas of p, shared with the threads in its pgdir.
+static struct vma* vmas(struct proc *p) {
+	return vmspace(p->pgdir)->vma;
+}
+
+// Find an unused vma in p, place it at the highest free range of
+// len bytes below MMAPTOP and above the heap, and give it type,
+// so that no thread of p takes it meanwhile. The caller fills in
+// the rest, or sets the type back to VMA_NONE. Returns 0 if there
+// is none.
+struct vma* vmaalloc(struct proc *p, uint len, int type) {
+	struct vma *v, *nv, *vma;
+	uint end;
+
+	if (len == 0 || len % PGSIZE)
+		return 0;
+	vma = vmas(p);
+	acquire(&vmtable.lock);
+	nv = 0;
+	for (v = vma; v < &vma[NVMA]; v++)
+		if (v->type == VMA_NONE) {
+			nv = v;
+			break;
+		}
+	if (nv == 0)
+		goto bad;
+
+	end = MMAPTOP;
+	again: if (end < len || end - len < PGROUNDUP(p->sz))
+		goto bad;
+	for (v = vma; v < &vma[NVMA]; v++)
+		if (v->type != VMA_NONE && v->start < end && v->end > end - len) {
+			end = v->start;
+			goto again;
+		}
+	memset(nv, 0, sizeof(*nv));
+	nv->type = type;
+	nv->start = end - len;
+	nv->end = end;
+	release(&vmtable.lock);
+	return nv;
+
+	bad: release(&vmtable.lock);
+	return 0;
+}
+
+// Return the vma of p that holds va, or 0.
+struct vma* vmalookup(struct proc *p, uint va) {
+	struct vma *v, *vma;
+
+	vma = vmas(p);
+	for (v = vma; v < &vma[NVMA]; v++)
+		if (v->type != VMA_NONE && va >= v->start && va < v->end)
+			return v;
+	return 0;
+}
+
+// Return the lowest address mapped by a vma of p: the heap
+// may grow up to here.
+uint vmabase(struct proc *p) {
+	struct vma *v, *vma;
+	uint base;
+
+	base = MMAPTOP;
+	vma = vmas(p);
+	for (v = vma; v < &vma[NVMA]; v++)
+		if (v->type != VMA_NONE && v->start < base)
+			base = v->start;
+	return base;
+}
+
+// Copy vma v to *c, holding its file if it maps one: a
+// thread sharing the pgdir may unmap v meanwhile. The caller
+// fileclose()s c->file when done with it.
+static void vmacopy(struct vma *v, struct vma *c) {
+	acquire(&vmtable.lock);
+	*c = *v;
+	if (c->type == VMA_FILE)
+		filedup(c->file);
+	release(&vmtable.lock);
+}
+
+// Give child np the vmas of p, the current process: the same
+// pages for MAP_SHARED mappings, copies of them for MAP_PRIVATE
+// ones. A shared anonymous mapping has nothing else to find its
+// pages by, so its untouched pages are filled in first; otherwise
+// parent and child would each fault in a page of their own.
+// On failure the caller must vmaclear() and freevm() np.
+int vmadup(struct proc *np, struct proc *p) {
+	struct vma *v, *vma, vm;
+	pte_t *pte;
+	uint a, pa;
+	char *mem;
+
+	vma = vmas(p);
+	for (v = vma; v < &vma[NVMA]; v++) {
+		// the copy's hold on the file becomes the child's
+		vmacopy(v, &vm);
+		if (vm.type == VMA_NONE)
+			continue;
+		vmas(np)[v - vma] = vm;
+		if (vm.type == VMA_SHM)
+			shmdup(&vm);
+		if (vm.type == VMA_ANON && (vm.flags & MAP_SHARED)
+				&& uvmpagein(p, vm.start, vm.end - vm.start) < 0)
+			return -1;
+		for (a = vm.start; a < vm.end; a += PGSIZE) {
+			if ((pte = walkpgdir(p->pgdir, (void*) a, 0)) == 0
+					|| (*pte & PTE_P) == 0)
+				continue;
+			pa = PTE_ADDR(*pte);
+			if (vm.flags & MAP_PRIVATE) {
+				if ((mem = kalloc()) == 0)
+					return -1;
+				memmove(mem, P2V(pa), PGSIZE);
+				if (mappages(np->pgdir, (void*) a, PGSIZE, V2P(mem),
+						PTE_FLAGS(*pte)) < 0) {
+					kfree(mem);
+					return -1;
+				}
+				continue;
+			}
+			if (mappages(np->pgdir, (void*) a, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
+				return -1;
+			kincref(P2V(pa));
+		}
+	}
+	return 0;
+}
+
+// Write the dirty pages in [start, end) of MAP_SHARED file
+// mapping v in p back to the file. Returns -1 if a write failed.
+static int vmasync(struct proc *p, struct vma *v, uint start, uint end) {
+	pte_t *pte;
+	uint a;
+	int r;
+
+	r = 0;
+	for (a = start; a < end; a += PGSIZE) {
+		if ((pte = walkpgdir(p->pgdir, (void*) a, 0)) == 0
+				|| (*pte & (PTE_P | PTE_D)) != (PTE_P | PTE_D))
+			continue;
+		if (filewriteat(v->file, P2V(PTE_ADDR(*pte)), v->off + a - v->start,
+				PGSIZE) < 0)
+			r = -1;
+		*pte &= ~PTE_D;
+	}
+	// so that the next write to a page sets PTE_D again
+	if (p == myproc())
+		lcr3(V2P(p->pgdir));
+	return r;
+}
+
+// Take the vma of p that starts at addr out of its table, so that
+// no thread sharing the pgdir finds it while the caller unmaps it,
+// and copy it to *c. It must be a shmat() segment if shm is set,
+// else an mmap() mapping, len bytes long unless len is 0.
+int vmadetach(struct proc *p, uint addr, uint len, int shm, struct vma *c) {
+	struct vma *v;
+
+	acquire(&vmtable.lock);
+	v = vmalookup(p, addr);
+	if (v == 0 || v->start != addr || (v->type == VMA_SHM) != shm
+			|| v->type == VMA_STACK
+			|| (len && PGROUNDUP(len) != v->end - v->start)) {
+		release(&vmtable.lock);
+		return -1;
+	}
+	*c = *v;
+	v->type = VMA_NONE;
+	release(&vmtable.lock);
+	return 0;
+}
+
+// Let go of vma v of p: write back a shared file mapping and
+// drop the mapping's hold on its segment or file. The caller
+// unmaps its pages, or frees the pgdir.
+static void vmadrop(struct proc *p, struct vma *v) {
+	if (v->type == VMA_SHM)
+		shmrelease(v);
+	else if (v->type == VMA_FILE) {
+		if (v->flags & MAP_SHARED)
+			vmasync(p, v, v->start, v->end);
+		fileclose(v->file);
+	}
+	v->type = VMA_NONE;
+}
+
+// Drop all vmas of p. Their pages stay mapped in p->pgdir
+// until it is freed, which frees the pages no one else maps.
+void vmaclear(struct proc *p) {
+	struct vma *v, *vma;
+
+	vma = vmas(p);
+	for (v = vma; v < &vma[NVMA]; v++)
+		if (v->type != VMA_NONE)
+			vmadrop(p, v);
+}
+
+// Count one more process in pgdir: a thread of its owner.
+void vmhold(pde_t *pgdir) {
+	acquire(&vmtable.lock);
+	vmspace(pgdir)->users++;
+	release(&vmtable.lock);
+}
+
+// p, the current process, is leaving its pgdir, by exit() or
+// exec(). The last one out drops the mappings.
+void vmput(struct proc *p) {
+	int last;
+
+	acquire(&vmtable.lock);
+	last = --vmspace(p->pgdir)->users == 0;
+	release(&vmtable.lock);
+	if (last)
+		vmaclear(p);
+}
+
+// Map len bytes of file f from offset off, or zero-filled
+// memory if f is 0, into the current process. Pages are only
+// filled in when first touched (see pagefault). The caller has
+// checked that f may be accessed as prot asks.
+// Returns the address of the mapping, or -1.
+int mmap(struct file *f, uint off, uint len, int prot, int flags) {
+	struct vma *v;
+
+	if (len == 0 || len > MMAPTOP || off % PGSIZE
+			|| ((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+		return -1;
+	if ((v = vmaalloc(myproc(), PGROUNDUP(len), f ? VMA_FILE : VMA_ANON)) == 0)
+		return -1;
+	v->prot = prot;
+	v->flags = flags & (MAP_SHARED | MAP_PRIVATE);
+	v->file = f ? filedup(f) : 0;
+	v->off = off;
+	return v->start;
+}
+
+// Remove the mmap() mapping at addr, which must be all of it,
+// writing back its dirty pages if it is a shared file mapping.
+int munmap(uint addr, uint len) {
+	struct proc *curproc = myproc();
+	struct vma vm;
+
+	if (len == 0 || vmadetach(curproc, addr, len, 0, &vm) < 0)
+		return -1;
+	vmadrop(curproc, &vm);
+	deallocuvm(curproc->pgdir, vm.end, vm.start);
+	lcr3(V2P(curproc->pgdir));
+	return 0;
+}
+
+// Write back the dirty pages of shared file mappings
+// in [addr, addr+len).
+int msync(uint addr, uint len) {
+	struct proc *curproc = myproc();
+	struct vma *v, *vma, vm;
+	uint start, end;
+	int r;
+
+	r = 0;
+	end = PGROUNDUP(addr + len);
+	vma = vmas(curproc);
+	for (v = vma; v < &vma[NVMA]; v++) {
+		vmacopy(v, &vm);
+		if (vm.type != VMA_FILE)
+			continue;
+		if ((vm.flags & MAP_SHARED) && vm.end > addr && vm.start < end) {
+			start = vm.start > addr ? vm.start : PGROUNDDOWN(addr);
+			if (vmasync(curproc, &vm, start, vm.end < end ? vm.end : end) < 0)
+				r = -1;
+		}
+		fileclose(vm.file);
+	}
+	return r;
+}
+
+// Read the swapped out page at a in pgdir back in.
+static int swapin(pde_t *pgdir, uint a) {
+	pte_t *pte;
+	char *mem;
+	uint old;
+
+	if ((mem = ualloc()) == 0)
+		return -1;
+	pte = walkpgdir(pgdir, (void*) a, 0);
+	old = *pte;
+	if (old & PTE_SWAP) {
+		swapread(PTE_ADDR(old) >> PGSHIFT, mem);
+		// a thread may have shrunk the heap, freeing the page table
+		if ((pgdir[PDX(a)] & (PTE_P | PTE_PS)) == PTE_P)
+			pte = walkpgdir(pgdir, (void*) a, 0);
+		else
+			old = 0;
+	}
+	if (!(old & PTE_SWAP) || *pte != old) {
+		// a thread sharing pgdir got to it first
+		kfree(mem);
+		return 0;
+	}
+	*pte = V2P(mem) | (PTE_FLAGS(old) & ~PTE_SWAP) | PTE_P;
+	vmcount(pgdir, 1, 0, 0);
+	swapfree(PTE_ADDR(old) >> PGSHIFT);
+	return 0;
+}
+
+// Fill in page a of vma v, a copy holding its file, in p,
+// the current process, for a fault with error code err.
+static int vmafill(struct proc *p, struct vma *v, uint a, uint err) {
+	pte_t *pte;
+	char *mem;
+
+	// a thread sharing the pgdir may have unmapped it meanwhile
+	if (v->type == VMA_NONE || v->type == VMA_SHM || a < v->start
+			|| a >= v->end)
+		return -1;
+	if ((err & FEC_WR) && !(v->prot & PROT_WRITE))
+		return -1;
+	// a thread sharing the pgdir filled it in first
+	if ((pte = walkpgdir(p->pgdir, (void*) a, 0)) != 0 && (*pte & PTE_P))
+		return 0;
+	if ((mem = ualloc()) == 0)
+		return -1;
+	// reads through the buffer cache; may sleep
+	if (v->type == VMA_FILE
+			&& filereadat(v->file, mem, v->off + a - v->start, PGSIZE) < 0) {
+		kfree(mem);
+		return -1;
+	}
+	// a thread sharing the pgdir may have filled it in meanwhile
+	if ((pte = walkpgdir(p->pgdir, (void*) a, 0)) != 0 && (*pte & PTE_P)) {
+		kfree(mem);
+		return 0;
+	}
+	if (mappages(p->pgdir, (void*) a, PGSIZE, V2P(mem),
+			PTE_U | ((v->prot & PROT_WRITE) ? PTE_W : 0)
+					| ((v->flags & MAP_SHARED) ? PTE_SHARED : 0)) < 0) {
+		kfree(mem);
+		return -1;
+	}
+	return 0;
+}
+
+// Handle a page fault at va in the current process, with error
+// code err (FEC_*), by reading the page back in from swap, or by
+// filling in the page of the file, anonymous or stack mapping that
+// holds it. Returns -1 if the access is not allowed: va is in no
+// such mapping, the mapping is read-only and this is a write, or
+// the page is there and the access broke its protection.
+int pagefault(uint va, uint err) {
+	struct proc *curproc = myproc();
+	struct vma *v, vm;
+	pte_t *pte;
+	uint a;
+	int r;
+
+	a = PGROUNDDOWN(va);
+	if ((err & FEC_PR) || a >= KERNBASE)
+		return -1;
+	if ((curproc->pgdir[PDX(a)] & (PTE_P | PTE_PS)) == PTE_P
+			&& (pte = walkpgdir(curproc->pgdir, (void*) a, 0)) != 0
+			&& (*pte & PTE_SWAP))
+		return swapin(curproc->pgdir, a);
+	if ((v = vmalookup(curproc, a)) == 0)
+		return -1;
+	vmacopy(v, &vm);
+	r = vmafill(curproc, &vm, a, err);
+	if (vm.type == VMA_FILE)
+		fileclose(vm.file);
+	return r;
+}
+
+// Fill in the swapped out and not yet touched pages in
+// [va, va+len) of p, so that the kernel can use them without
+// faulting, e.g. while holding locks. Returns -1 if one cannot
+// be filled in.
+int uvmpagein(struct proc *p, uint va, uint len) {
+	pte_t *pte;
+	uint a;
+
+	for (a = PGROUNDDOWN(va); a < va + len; a += PGSIZE) {
+		if ((p->pgdir[PDX(a)] & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+			continue;
+		if ((pte = walkpgdir(p->pgdir, (void*) a, 0)) != 0 && (*pte & PTE_P))
+			continue;
+		if (pagefault(a, 0) < 0)
+			return -1;
+	}
+	return 0;
+}
+
 //PAGEBREAK!
 // Blank page.
 //PAGEBREAK!
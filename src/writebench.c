@@ -0,0 +1,100 @@
+// Benchmark concurrent file system writers: 1, 2, 4 and 8
+// processes each create, write and remove small files over and
+// over. With group commit, the operations of the writers share
+// disk commits, so file operations per tick grow with the number
+// of writers. Then measure write bandwidth to one large file.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define FILESZ  (4*512)
+#define NFILE   20
+#define BIGSZ   (128*512)
+#define NBIG    10
+
+static char buf[512];
+static char bigbuf[16*512];
+
+static void
+writer(int id)
+{
+  char name[] = "wbench.x";
+  int fd, i, j;
+
+  name[7] = 'a' + id;
+  for(i = 0; i < NFILE; i++){
+    if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+      printf(2, "writebench: create %s failed\n", name);
+      exit();
+    }
+    for(j = 0; j < FILESZ; j += sizeof(buf))
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf(2, "writebench: write failed\n");
+        exit();
+      }
+    close(fd);
+    unlink(name);
+  }
+  exit();
+}
+
+static void
+bigwrite(void)
+{
+  int fd, i, j, start, ticks;
+
+  start = uptime();
+  for(i = 0; i < NBIG; i++){
+    if((fd = open("wbench.big", O_CREATE | O_RDWR)) < 0){
+      printf(2, "writebench: create wbench.big failed\n");
+      exit();
+    }
+    for(j = 0; j < BIGSZ; j += sizeof(bigbuf))
+      if(write(fd, bigbuf, sizeof(bigbuf)) != sizeof(bigbuf)){
+        printf(2, "writebench: write failed\n");
+        exit();
+      }
+    close(fd);
+    unlink("wbench.big");
+  }
+  ticks = uptime() - start;
+  printf(1, "large file: %d KB in %d ticks", NBIG * BIGSZ / 1024, ticks);
+  if(ticks > 0)
+    printf(1, " (%d KB per tick)", NBIG * BIGSZ / 1024 / ticks);
+  printf(1, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, start, ticks, ops;
+
+  memset(buf, 'w', sizeof(buf));
+  memset(bigbuf, 'W', sizeof(bigbuf));
+  printf(1, "procs\tticks\tfile ops\n");
+  for(n = 1; n <= 8; n *= 2){
+    start = uptime();
+    for(i = 0; i < n; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf(2, "writebench: fork failed\n");
+        exit();
+      }
+      if(pid == 0)
+        writer(i);
+    }
+    for(i = 0; i < n; i++)
+      wait();
+    ticks = uptime() - start;
+    // open, FILESZ/512 writes, close and unlink per file
+    ops = n * NFILE * (FILESZ / sizeof(buf) + 3);
+    printf(1, "%d\t%d\t%d", n, ticks, ops);
+    if(ticks > 0)
+      printf(1, "\t(%d per tick)", ops / ticks);
+    printf(1, "\n");
+  }
+  bigwrite();
+  exit();
+}